@@ -0,0 +1,334 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark helpers for the Vookoo high level C++ Vulkan interface.
+//
+// These provide a device without a window or validation layers so that
+// the benchmarks can run on software ICDs such as lavapipe and SwiftShader.
+//
+// Every benchmark takes the same options, handled by bench::finish():
+//
+//   --json results.json       write the results
+//   --compare baseline.json   compare with earlier results and fail on regressions
+//   --threshold 0.1           the fractional change counted as a regression (default 10%)
+//
+// Inputs such as FBX files or traces are named before the options.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_BENCH_HPP
+#define VKU_BENCH_HPP
+
+#include <vku/vku.hpp>
+
+#include <gilgamesh/mesh.hpp>
+#include <gilgamesh/scene.hpp>
+#include <gilgamesh/decoders/fbx_decoder.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+/// A headless instance, device and queue.
+class Context {
+public:
+  Context() {
+    vk::ApplicationInfo appinfo{};
+    appinfo.pApplicationName = "vku benchmark";
+    appinfo.apiVersion = VK_API_VERSION_1_1;
+    instance_ = vk::createInstanceUnique(vk::InstanceCreateInfo{{}, &appinfo});
+
+    auto pds = instance_->enumeratePhysicalDevices();
+    if (pds.empty()) return;
+    physicalDevice_ = pds[0];
+
+    // Prefer a family that does everything, as the Framework does.
+    auto qprops = physicalDevice_.getQueueFamilyProperties();
+    vk::QueueFlags search = vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute;
+    const auto badQueue = ~(uint32_t)0;
+    queueFamilyIndex_ = badQueue;
+    for (uint32_t qi = 0; qi != qprops.size(); ++qi) {
+      if ((qprops[qi].queueFlags & search) == search) {
+        queueFamilyIndex_ = qi;
+        break;
+      }
+    }
+    for (uint32_t qi = 0; qi != qprops.size() && queueFamilyIndex_ == badQueue; ++qi) {
+      if (qprops[qi].queueFlags & vk::QueueFlagBits::eCompute) {
+        queueFamilyIndex_ = qi;
+      }
+    }
+    if (queueFamilyIndex_ == badQueue) return;
+
+    float queue_priorities[] = {1.0f};
+    vk::DeviceQueueCreateInfo qci{{}, queueFamilyIndex_, 1, queue_priorities};
+    device_ = physicalDevice_.createDeviceUnique(vk::DeviceCreateInfo{{}, 1, &qci});
+    queue_ = device_->getQueue(queueFamilyIndex_, 0);
+
+    vk::CommandPoolCreateInfo cpci{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndex_};
+    commandPool_ = device_->createCommandPoolUnique(cpci);
+
+    memprops_ = physicalDevice_.getMemoryProperties();
+    properties_ = physicalDevice_.getProperties();
+    ok_ = true;
+  }
+
+  ~Context() {
+    if (device_) device_->waitIdle();
+  }
+
+  bool ok() const { return ok_; }
+  vk::Instance instance() const { return *instance_; }
+  vk::PhysicalDevice physicalDevice() const { return physicalDevice_; }
+  vk::Device device() const { return *device_; }
+  vk::Queue queue() const { return queue_; }
+  uint32_t queueFamilyIndex() const { return queueFamilyIndex_; }
+  vk::CommandPool commandPool() const { return *commandPool_; }
+  const vk::PhysicalDeviceMemoryProperties &memprops() const { return memprops_; }
+  const vk::PhysicalDeviceProperties &properties() const { return properties_; }
+
+private:
+  vk::UniqueInstance instance_;
+  vk::PhysicalDevice physicalDevice_;
+  vk::UniqueDevice device_;
+  vk::Queue queue_;
+  uint32_t queueFamilyIndex_ = 0;
+  vk::UniqueCommandPool commandPool_;
+  vk::PhysicalDeviceMemoryProperties memprops_;
+  vk::PhysicalDeviceProperties properties_;
+  bool ok_ = false;
+};
+
+/// Copy the contents of a device local buffer back to the host.
+/// The buffer needs eTransferSrc usage.
+template <class Type>
+std::vector<Type> download(const Context &ctx, const vku::GenericBuffer &buffer, size_t count) {
+  std::vector<Type> result(count);
+  vk::DeviceSize size = count * sizeof(Type);
+  if (size == 0) return result;
+  vku::GenericBuffer staging(ctx.device(), ctx.memprops(), vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eHostVisible);
+  vku::executeImmediately(ctx.device(), ctx.commandPool(), ctx.queue(), [&](vk::CommandBuffer cb) {
+    cb.copyBuffer(buffer.buffer(), staging.buffer(), vk::BufferCopy{0, 0, size});
+  });
+  staging.invalidate(ctx.device());
+  memcpy(result.data(), staging.map(ctx.device()), (size_t)size);
+  staging.unmap(ctx.device());
+  return result;
+}
+
+/// Call fn repeatedly for at least minSeconds and return the mean seconds per call.
+template <class Fn>
+double secondsPerCall(Fn fn, double minSeconds = 0.25) {
+  typedef std::chrono::high_resolution_clock clock;
+  fn(); // warm up
+  size_t calls = 0;
+  auto start = clock::now();
+  double elapsed = 0;
+  do {
+    fn();
+    ++calls;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < minSeconds);
+  return elapsed / calls;
+}
+
+/// Call fn(threads, suffix) with one thread and, if there is more than one core, with one per core.
+/// suffix is " 1 thread" or " all threads", to keep result names unique.
+template <class Fn>
+void forThreadCounts(Fn fn) {
+  fn(1u, std::string(" 1 thread"));
+  unsigned cores = std::thread::hardware_concurrency();
+  if (cores > 1) fn(cores, std::string(" all threads"));
+}
+
+/// The index of the first option. The arguments before it are inputs such as file names.
+inline int firstOption(int argc, char **argv) {
+  int arg = 1;
+  while (arg < argc && argv[arg][0] != '-') ++arg;
+  return arg;
+}
+
+/// Call fn(name, mesh) for each mesh with triangles in the FBX files named before the options.
+/// Returns false if a file could not be loaded.
+template <class Mesh, class Fn>
+bool forEachFbxMesh(int argc, char **argv, Fn fn) {
+  for (int arg = 1; arg != firstOption(argc, argv); ++arg) {
+    // The decoder does not check that the file opened.
+    gilgamesh::scene scene;
+    gilgamesh::fbx_decoder decoder;
+    if (!std::ifstream(argv[arg]) || !decoder.loadScene<Mesh>(scene, argv[arg])) {
+      std::cerr << "could not load " << argv[arg] << "\n";
+      return false;
+    }
+    // The scene does not own its meshes.
+    for (size_t i = 0; i != scene.meshes().size(); ++i) {
+      std::unique_ptr<gilgamesh::mesh> owner(scene.meshes()[i]);
+      auto mesh = dynamic_cast<Mesh *>(owner.get());
+      if (mesh && !mesh->indices().empty()) {
+        fn(std::string(argv[arg]) + " mesh " + std::to_string(i), *mesh);
+      }
+    }
+  }
+  return true;
+}
+
+/// One measurement. Rates (units ending in "/s") are better when higher, times when lower.
+struct Result {
+  std::string name;
+  double value;
+  std::string units;
+
+  bool higherIsBetter() const {
+    return units.size() >= 2 && units.compare(units.size() - 2, 2, "/s") == 0;
+  }
+};
+
+/// The results reported so far.
+inline std::vector<Result> &results() {
+  static std::vector<Result> r;
+  return r;
+}
+
+/// Print one result line and keep it for finish(). Names must be unique.
+inline void report(const std::string &name, double value, const char *units) {
+  std::cout << name << ": " << value << " " << units << "\n";
+  results().push_back(Result{name, value, units});
+}
+
+/// Write results as JSON.
+inline void writeJson(std::ostream &os, const std::vector<Result> &res) {
+  auto escape = [](const std::string &str) {
+    std::string r;
+    for (char c : str) {
+      if (c == '"' || c == '\\') r += '\\';
+      r += c;
+    }
+    return r;
+  };
+  os.precision(9);
+  os << "{\n  \"results\": [";
+  for (size_t i = 0; i != res.size(); ++i) {
+    os << (i ? ",\n" : "\n") << "    {\"name\": \"" << escape(res[i].name) << "\", \"value\": " << res[i].value << ", \"units\": \"" << escape(res[i].units) << "\"}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+/// Read results written by writeJson(). This is not a general JSON parser.
+inline std::vector<Result> readJson(std::istream &is) {
+  std::stringstream ss;
+  ss << is.rdbuf();
+  std::string text = ss.str();
+
+  // Read the string after a key, starting the search at pos.
+  auto field = [&text](const char *key, size_t &pos) {
+    std::string r;
+    pos = text.find(key, pos);
+    if (pos == std::string::npos) return r;
+    pos = text.find('"', pos + strlen(key));
+    if (pos == std::string::npos) return r;
+    for (++pos; pos < text.size() && text[pos] != '"'; ++pos) {
+      if (text[pos] == '\\') ++pos;
+      if (pos < text.size()) r += text[pos];
+    }
+    return r;
+  };
+
+  std::vector<Result> res;
+  size_t pos = 0;
+  while (true) {
+    Result r;
+    r.name = field("\"name\":", pos);
+    if (pos == std::string::npos) break;
+    size_t vpos = text.find("\"value\":", pos);
+    if (vpos == std::string::npos) break;
+    r.value = strtod(text.c_str() + vpos + 8, nullptr);
+    pos = vpos;
+    r.units = field("\"units\":", pos);
+    if (pos == std::string::npos) break;
+    res.push_back(r);
+  }
+  return res;
+}
+
+/// Compare with a baseline. Prints every change and returns the number of regressions beyond threshold.
+inline int compare(const std::vector<Result> &baseline, const std::vector<Result> &res, double threshold) {
+  int regressions = 0;
+  std::cout << "\nComparison with baseline (threshold " << threshold * 100 << "%, positive changes are worse):\n";
+  for (auto &r : res) {
+    const Result *base = nullptr;
+    for (auto &b : baseline) {
+      if (b.name == r.name) base = &b;
+    }
+    if (!base || base->value == 0) {
+      std::cout << "  new   " << r.name << "\n";
+      continue;
+    }
+
+    // Positive change is worse.
+    double change = (r.value - base->value) / std::fabs(base->value);
+    if (r.higherIsBetter()) change = -change;
+    bool regressed = change > threshold;
+    regressions += regressed;
+    std::cout << (regressed ? "  WORSE " : change < -threshold ? "  better" : "  same  ");
+    std::cout << " " << r.name << ": " << base->value << " -> " << r.value << " " << r.units;
+    std::cout << " (" << (change > 0 ? "+" : "") << change * 100 << "%)\n";
+  }
+  return regressions;
+}
+
+/// Handle the command line options: write JSON and compare with a baseline.
+/// The options start at argv[firstOption], after any inputs (see bench::firstOption()).
+/// Returns status, or 1 if there was a regression or an error.
+/// example:
+///     int main(int argc, char **argv) {
+///       ...
+///       return bench::finish(argc, argv);
+///     }
+inline int finish(int argc, char **argv, int status = 0, int firstOption = 1) {
+  std::string jsonFile, compareFile;
+  double threshold = 0.1;
+  for (int i = firstOption; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--json") {
+      jsonFile = argv[++i];
+    } else if (i + 1 < argc && arg == "--compare") {
+      compareFile = argv[++i];
+    } else if (i + 1 < argc && arg == "--threshold") {
+      threshold = atof(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json results.json] [--compare baseline.json] [--threshold 0.1]\n";
+      return 1;
+    }
+  }
+
+  if (!jsonFile.empty()) {
+    std::ofstream file(jsonFile);
+    writeJson(file, results());
+    if (!file) {
+      std::cerr << "could not write " << jsonFile << "\n";
+      return 1;
+    }
+  }
+
+  if (!compareFile.empty()) {
+    std::ifstream file(compareFile);
+    if (!file) {
+      std::cerr << "could not read " << compareFile << "\n";
+      return 1;
+    }
+    if (compare(readJson(file), results(), threshold)) return 1;
+  }
+  return status;
+}
+
+} // namespace bench
+
+#endif // VKU_BENCH_HPP
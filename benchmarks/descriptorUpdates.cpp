@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Descriptor set update rates.
+//
+// Compares a new DescriptorSetUpdater per update, a reused updater
+// and a descriptor update template writing from a packed structure.
+//
+
+#include "bench.hpp"
+
+// The template layout must match the C++ struct it reads, whatever the order of the types.
+static bool checkTemplateLayout() {
+  struct Mixed {
+    vk::BufferView texels;
+    vk::DescriptorBufferInfo ubo;
+    vk::BufferView storageTexels[3];
+    vk::DescriptorImageInfo image;
+    vk::BufferView last;
+  };
+
+  vku::DescriptorUpdateTemplateMaker dutm;
+  dutm.binding(0, vk::DescriptorType::eUniformTexelBuffer);
+  dutm.binding(1, vk::DescriptorType::eUniformBuffer);
+  dutm.binding(2, vk::DescriptorType::eStorageTexelBuffer, 3);
+  dutm.binding(3, vk::DescriptorType::eCombinedImageSampler);
+  dutm.binding(4, vk::DescriptorType::eUniformTexelBuffer);
+
+  size_t offsets[] = {
+    offsetof(Mixed, texels), offsetof(Mixed, ubo), offsetof(Mixed, storageTexels),
+    offsetof(Mixed, image), offsetof(Mixed, last)
+  };
+  bool ok = dutm.size() == sizeof(Mixed);
+  for (size_t i = 0; i != dutm.entries().size(); ++i) {
+    ok = ok && dutm.entries()[i].offset == offsets[i];
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (!checkTemplateLayout()) {
+    std::cout << "Template layout does not match the struct" << std::endl;
+    return 1;
+  }
+
+  bench::Context ctx;
+  if (!ctx.ok()) {
+    std::cout << "No Vulkan device" << std::endl;
+    return 1;
+  }
+
+  vk::Device device = ctx.device();
+
+  // A typical material: uniforms, a storage buffer and a texture.
+  vku::DescriptorSetLayoutMaker dslm{};
+  dslm.buffer(0, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eAll, 1);
+  dslm.buffer(1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eAll, 1);
+  dslm.image(2, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eFragment, 1);
+  auto layout = dslm.createUnique(device);
+
+  const int numSets = 64;
+  vku::DescriptorAllocator alloc{device};
+  auto sets = alloc.allocate(std::vector<vk::DescriptorSetLayout>(numSets, *layout));
+
+  vku::UniformBuffer ubo(device, ctx.memprops(), 256);
+  vku::GenericBuffer ssbo(device, ctx.memprops(), vk::BufferUsageFlagBits::eStorageBuffer, 1024);
+  vku::TextureImage2D texture(device, ctx.memprops(), 4, 4);
+  auto sampler = vku::SamplerMaker{}.createUnique(device);
+  auto imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+  // The way the examples do it: a new updater for every set.
+  double newUpdater = bench::secondsPerCall([&]() {
+    for (auto set : sets) {
+      vku::DescriptorSetUpdater update;
+      update.beginDescriptorSet(set);
+      update.beginBuffers(0, 0, vk::DescriptorType::eUniformBuffer);
+      update.buffer(ubo.buffer(), 0, 256);
+      update.beginBuffers(1, 0, vk::DescriptorType::eStorageBuffer);
+      update.buffer(ssbo.buffer(), 0, 1024);
+      update.beginImages(2, 0, vk::DescriptorType::eCombinedImageSampler);
+      update.image(*sampler, texture.imageView(), imageLayout);
+      update.update(device);
+    }
+  }) / numSets;
+
+  // One updater, cleared between sets.
+  vku::DescriptorSetUpdater update;
+  double reusedUpdater = bench::secondsPerCall([&]() {
+    for (auto set : sets) {
+      update.clear();
+      update.beginDescriptorSet(set);
+      update.beginBuffers(0, 0, vk::DescriptorType::eUniformBuffer);
+      update.buffer(ubo.buffer(), 0, 256);
+      update.beginBuffers(1, 0, vk::DescriptorType::eStorageBuffer);
+      update.buffer(ssbo.buffer(), 0, 1024);
+      update.beginImages(2, 0, vk::DescriptorType::eCombinedImageSampler);
+      update.image(*sampler, texture.imageView(), imageLayout);
+      update.update(device);
+    }
+  }) / numSets;
+
+  // A template compiled once from the layout.
+  struct Descriptors {
+    vk::DescriptorBufferInfo ubo;
+    vk::DescriptorBufferInfo ssbo;
+    vk::DescriptorImageInfo texture;
+  };
+
+  vku::DescriptorUpdateTemplateMaker dutm{dslm};
+  if (dutm.size() != sizeof(Descriptors)) {
+    std::cout << "Template size mismatch" << std::endl;
+    return 1;
+  }
+  auto tmpl = dutm.createUnique(device, *layout);
+
+  Descriptors d{
+    {ubo.buffer(), 0, 256},
+    {ssbo.buffer(), 0, 1024},
+    {*sampler, texture.imageView(), imageLayout}
+  };
+  double templated = bench::secondsPerCall([&]() {
+    for (auto set : sets) {
+      vku::updateDescriptorSet(device, set, *tmpl, d);
+    }
+  }) / numSets;
+
+  bench::report("DescriptorSetUpdater (new per set)", 1.0 / newUpdater, "updates/s");
+  bench::report("DescriptorSetUpdater (reused)", 1.0 / reusedUpdater, "updates/s");
+  bench::report("DescriptorUpdateTemplate", 1.0 / templated, "updates/s");
+
+  return bench::finish(argc, argv);
+}
@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Command recording cost through the loader and through a device level
+// dispatch table (vku::DeviceDispatch).
+//
+// Each pass records the same command many times into one command buffer,
+// which is reset between passes and never submitted. Compute commands are used
+// because they can be recorded outside a render pass; every vkCmd* goes through
+// the same trampoline, so draws see the same difference.
+//
+
+#include "bench.hpp"
+
+// Seconds per command for recording fn numCommands times after a prologue.
+template <class Prologue, class Fn>
+double secondsPerCommand(vk::CommandBuffer cb, int numCommands, Prologue prologue, Fn fn) {
+  return bench::secondsPerCall([&]() {
+    cb.reset(vk::CommandBufferResetFlags{});
+    cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    prologue();
+    for (int i = 0; i != numCommands; ++i) {
+      fn();
+    }
+    cb.end();
+  }) / numCommands;
+}
+
+int main(int argc, char **argv) {
+  bench::Context ctx;
+  if (!ctx.ok()) {
+    std::cout << "No Vulkan device" << std::endl;
+    return 1;
+  }
+
+  vk::Device device = ctx.device();
+  auto &memprops = ctx.memprops();
+
+  vku::ShaderModule shader{device, BINARY_DIR "scan_add.comp.spv"};
+  if (!shader.ok()) {
+    std::cout << "scan_add.comp.spv not found" << std::endl;
+    return 1;
+  }
+
+  uint32_t count = 256;
+  vku::ComputeKernel kernel{device, memprops, ctx.queueFamilyIndex(), std::move(shader), sizeof(count), {64}};
+  kernel.pushConstants(count);
+
+  vku::GenericBuffer data(device, memprops, vk::BufferUsageFlagBits::eStorageBuffer, count * sizeof(uint32_t));
+  vku::GenericBuffer sums(device, memprops, vk::BufferUsageFlagBits::eStorageBuffer, count * sizeof(uint32_t));
+  kernel.beginFrame(0);
+  vk::DescriptorSet set = kernel.allocateDescriptorSet();
+  vku::DescriptorSetUpdater update;
+  update.beginDescriptorSet(set);
+  update.beginBuffers(0, 0, vk::DescriptorType::eStorageBuffer);
+  update.buffer(data.buffer(), 0, VK_WHOLE_SIZE);
+  update.beginBuffers(1, 0, vk::DescriptorType::eStorageBuffer);
+  update.buffer(sums.buffer(), 0, VK_WHOLE_SIZE);
+  update.update(device);
+
+  vk::CommandBufferAllocateInfo cbai{ctx.commandPool(), vk::CommandBufferLevel::ePrimary, 1};
+  auto commandBuffers = device.allocateCommandBuffersUnique(cbai);
+  vk::CommandBuffer cb = *commandBuffers[0];
+
+  vk::DispatchLoaderStatic loader;
+  vku::DeviceDispatch direct{ctx.instance(), device};
+  vk::PipelineLayout layout = kernel.pipelineLayout();
+  const int numCommands = 10000;
+
+  // Bind the pipeline and set so that every recorded command is valid.
+  auto prologue = [&]() { kernel.dispatch(cb, set, 1, 1, 1); };
+
+  auto compare = [&](const std::string &name, double loaderTime, double directTime) {
+    bench::report(name + " loader", loaderTime * 1e9, "ns");
+    bench::report(name + " device dispatch", directTime * 1e9, "ns");
+  };
+
+  compare("bindDescriptorSets",
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, set, nullptr, loader); }),
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, set, nullptr, direct); })
+  );
+
+  compare("pushConstants",
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(count), &count, loader); }),
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(count), &count, direct); })
+  );
+
+  compare("dispatch",
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.dispatch(1, 1, 1, loader); }),
+    secondsPerCommand(cb, numCommands, prologue, [&]() { cb.dispatch(1, 1, 1, direct); })
+  );
+
+  // Four commands: bind pipeline, bind set, push constants and dispatch.
+  compare("ComputeKernel::dispatch",
+    secondsPerCommand(cb, numCommands, prologue, [&]() { kernel.dispatch(cb, set, 1, 1, 1, loader); }),
+    secondsPerCommand(cb, numCommands, prologue, [&]() { kernel.dispatch(cb, set, 1, 1, 1, direct); })
+  );
+
+  return bench::finish(argc, argv);
+}
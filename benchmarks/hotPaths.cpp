@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Costs of the vku calls applications make most.
+//
+// Buffer and image uploads through staging buffers, executeImmediately
+// latency, compute pipeline creation with a cold and a warm pipeline cache,
+// SPIR-V reflection and KTX header parsing.
+//
+
+#include "bench.hpp"
+
+int main(int argc, char **argv) {
+  bench::Context ctx;
+  if (!ctx.ok()) {
+    std::cout << "No Vulkan device" << std::endl;
+    return 1;
+  }
+
+  vk::Device device = ctx.device();
+  auto &memprops = ctx.memprops();
+  vk::CommandPool commandPool = ctx.commandPool();
+  vk::Queue queue = ctx.queue();
+  int status = 0;
+
+  // Buffer uploads by size. Small uploads are dominated by the staging allocation and the wait.
+  for (size_t size : {4u << 10, 64u << 10, 1u << 20, 16u << 20}) {
+    std::vector<uint8_t> bytes(size, 0x5a);
+    vku::GenericBuffer buffer(device, memprops, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, size);
+    double t = bench::secondsPerCall([&]() {
+      buffer.upload(device, memprops, commandPool, queue, bytes);
+    });
+    bench::report("GenericBuffer::upload " + std::to_string(size >> 10) + "KB", size / t * 1e-6, "MB/s");
+  }
+
+  // 1024x1024 image uploads by format, where the format can be sampled.
+  typedef vk::Format fmt;
+  for (auto format : {fmt::eR8G8B8A8Unorm, fmt::eR16G16B16A16Sfloat, fmt::eR32G32B32A32Sfloat, fmt::eBc1RgbaUnormBlock, fmt::eBc7UnormBlock}) {
+    auto props = ctx.physicalDevice().getFormatProperties(format);
+    if (!(props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)) {
+      std::cout << "TextureImage2D::upload " << vk::to_string(format) << ": not supported\n";
+      continue;
+    }
+    const uint32_t size = 1024;
+    auto bp = vku::getBlockParams(format);
+    std::vector<uint8_t> bytes((size / bp.blockWidth) * (size / bp.blockHeight) * bp.bytesPerBlock, 0x5a);
+    vku::TextureImage2D image(device, memprops, size, size, 1, format);
+    double t = bench::secondsPerCall([&]() {
+      image.setCurrentLayout(vk::ImageLayout::eUndefined);
+      image.upload(device, bytes, commandPool, memprops, queue);
+    });
+    bench::report("TextureImage2D::upload " + vk::to_string(format), bytes.size() / t * 1e-6, "MB/s");
+  }
+
+  // The round trip of an empty submission.
+  double immediate = bench::secondsPerCall([&]() {
+    vku::executeImmediately(device, commandPool, queue, [](vk::CommandBuffer) {});
+  });
+  bench::report("executeImmediately", immediate * 1e6, "us");
+
+  // Reflection and pipeline creation use a shader built with the benchmarks.
+  vku::ShaderModule shader{device, BINARY_DIR "frustum_cull.comp.spv"};
+  if (shader.ok()) {
+    double reflect = bench::secondsPerCall([&]() {
+      auto vars = shader.getVariables();
+      if (vars.empty()) status = 1;
+    });
+    bench::report("ShaderModule::getVariables", reflect * 1e6, "us");
+
+    vku::DescriptorSetLayoutMaker dslm{};
+    for (auto &v : shader.getVariables()) {
+      if (v.isDescriptor) dslm.buffer(v.binding, v.descriptorType, vk::ShaderStageFlagBits::eCompute, 1);
+    }
+    auto descriptorSetLayout = dslm.createUnique(device);
+    vku::PipelineLayoutMaker plm{};
+    plm.descriptorSetLayout(*descriptorSetLayout);
+    plm.pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, 128);
+    auto pipelineLayout = plm.createUnique(device);
+
+    vku::ComputePipelineMaker cpm{};
+    cpm.shader(vk::ShaderStageFlagBits::eCompute, shader);
+
+    // Drivers may keep their own cache, so a cold vku cache is not always a cold compile.
+    double cold = bench::secondsPerCall([&]() {
+      auto cache = device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo{});
+      cpm.createUnique(device, *cache, *pipelineLayout);
+    });
+    auto warmCache = device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo{});
+    cpm.createUnique(device, *warmCache, *pipelineLayout);
+    double warm = bench::secondsPerCall([&]() {
+      cpm.createUnique(device, *warmCache, *pipelineLayout);
+    });
+    bench::report("ComputePipelineMaker::createUnique cold cache", cold * 1e3, "ms");
+    bench::report("ComputePipelineMaker::createUnique warm cache", warm * 1e3, "ms");
+  } else {
+    std::cout << "frustum_cull.comp.spv not found, skipping reflection and pipelines\n";
+  }
+
+  // KTX parsing, from the texture example.
+  auto ktx = vku::loadFile(SOURCE_DIR "../examples/okretnica.ktx");
+  if (!ktx.empty()) {
+    double parse = bench::secondsPerCall([&]() {
+      vku::KTXFileLayout layout(ktx.data(), ktx.data() + ktx.size());
+      if (!layout.ok()) status = 1;
+    });
+    bench::report("KTXFileLayout", parse * 1e6, "us");
+  } else {
+    std::cout << "okretnica.ktx not found, skipping KTX parsing\n";
+  }
+
+  return bench::finish(argc, argv, status);
+}
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Isosurface extraction with the basic_mesh field constructor (marching cubes).
+//
+// The same metaball field is evaluated one grid point at a time and one row at
+// a time through the batched fn(i, j, k, count, values) form, on one thread and
+// on one per core. Grid sizes named before the options are measured instead of
+// the defaults:
+//
+//   bench-marchingCubes 512 [--json results.json] [--compare baseline.json]
+//
+
+#include "bench.hpp"
+
+typedef gilgamesh::simple_mesh mesh_t;
+
+// Eight metaballs in a grid of size dim.
+struct Metaballs {
+  float x[8], y[8], z[8], r2[8];
+
+  Metaballs(int dim) {
+    for (int b = 0; b != 8; ++b) {
+      x[b] = dim * (0.3f + 0.4f * (b & 1)) + dim * 0.05f * b;
+      y[b] = dim * (0.3f + 0.4f * ((b >> 1) & 1));
+      z[b] = dim * (0.3f + 0.4f * (b >> 2)) - dim * 0.03f * b;
+      r2[b] = dim * dim * (0.01f + 0.002f * b);
+    }
+  }
+
+  float operator()(int i, int j, int k) const {
+    float sum = 0;
+    for (int b = 0; b != 8; ++b) {
+      float dx = i - x[b], dy = j - y[b], dz = k - z[b];
+      sum += r2[b] / (dx * dx + dy * dy + dz * dz + 1.0f);
+    }
+    return 1.0f - sum;
+  }
+
+  // The y and z terms are shared by the row and the points are done eight
+  // lanes at a time, a fixed trip count that the compiler vectorises.
+  void operator()(int i, int j, int k, int count, float *values) const {
+    float dyz[8];
+    for (int b = 0; b != 8; ++b) {
+      float dy = j - y[b], dz = k - z[b];
+      dyz[b] = dy * dy + dz * dz + 1.0f;
+    }
+    for (int n = 0; n < count; n += 8) {
+      float sum[8] = {};
+      for (int b = 0; b != 8; ++b) {
+        for (int l = 0; l != 8; ++l) {
+          float dx = (float)(i + n + l) - x[b];
+          sum[l] += r2[b] / (dx * dx + dyz[b]);
+        }
+      }
+      for (int l = 0; l != 8 && n + l != count; ++l) {
+        values[n + l] = 1.0f - sum[l];
+      }
+    }
+  }
+};
+
+// Only the one point form, as written before the batched form existed.
+struct PointField {
+  Metaballs field;
+  float operator()(int i, int j, int k) const { return field(i, j, k); }
+};
+
+static mesh_t::vertex_t makeVertex(float x, float y, float z) {
+  return mesh_t::vertex_t(glm::vec3(x, y, z), glm::vec3(0, 0, 1), glm::vec2(0));
+}
+
+static void measure(int dim) {
+  Metaballs field(dim);
+  PointField point{field};
+  size_t numTriangles = 0;
+  std::string name = "marching cubes " + std::to_string(dim);
+
+  bench::forThreadCounts([&](unsigned threads, const std::string &suffix) {
+    double pointTime = bench::secondsPerCall([&]() {
+      mesh_t mesh(dim, dim, dim, point, makeVertex, threads);
+      numTriangles = mesh.indices().size() / 3;
+    });
+    double rowTime = bench::secondsPerCall([&]() {
+      mesh_t mesh(dim, dim, dim, field, makeVertex, threads);
+    });
+    bench::report(name + " per point" + suffix, pointTime * 1e3, "ms");
+    bench::report(name + " per row" + suffix, rowTime * 1e3, "ms");
+  });
+  std::cout << name << ": " << numTriangles << " triangles\n";
+}
+
+int main(int argc, char **argv) {
+  int firstOption = bench::firstOption(argc, argv);
+  for (int arg = 1; arg != firstOption; ++arg) {
+    measure(std::atoi(argv[arg]));
+  }
+  if (firstOption == 1) {
+    measure(128);
+    measure(256);
+  }
+  return bench::finish(argc, argv, 0, firstOption);
+}
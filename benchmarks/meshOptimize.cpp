@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vertex cache and overdraw ordering of gilgamesh meshes (basic_mesh::optimize).
+//
+// Reports ACMR (vertices transformed per triangle) and ATVR (vertices transformed
+// per vertex) for a 16 entry FIFO cache before and after, and the time taken.
+// FBX files named before the options are measured too:
+//
+//   bench-meshOptimize model.fbx [--json results.json] [--compare baseline.json]
+//
+
+#include "bench.hpp"
+
+#include <gilgamesh/shapes/teapot.hpp>
+
+typedef gilgamesh::simple_mesh mesh_t;
+
+static void measure(const std::string &name, const mesh_t &original) {
+  mesh_t mesh;
+  auto optimize = [&]() {
+    mesh.vertices() = original.vertices();
+    mesh.indices() = original.indices();
+    mesh.optimize();
+  };
+  double t = bench::secondsPerCall(optimize);
+
+  auto before = original.cacheStats();
+  auto after = mesh.cacheStats();
+  std::cout << name << ": " << original.indices().size() / 3 << " triangles, " << original.vertices().size() << " vertices\n";
+  bench::report(name + " ACMR before", before.acmr, "verts/tri");
+  bench::report(name + " ACMR after", after.acmr, "verts/tri");
+  bench::report(name + " ATVR before", before.atvr, "verts/vert");
+  bench::report(name + " ATVR after", after.atvr, "verts/vert");
+  bench::report(name + " optimize", t * 1e3, "ms");
+}
+
+int main(int argc, char **argv) {
+  gilgamesh::teapot shape;
+  for (int subdivs : {8, 32}) {
+    mesh_t teapot;
+    shape.build(teapot, glm::mat4{1}, glm::vec4{1}, subdivs);
+    teapot.reindex(true);
+    measure("teapot " + std::to_string(subdivs), teapot);
+  }
+
+  // Marching cubes output, as made by the basic_mesh field constructor.
+  const int dim = 64;
+  mesh_t sphere(dim, dim, dim,
+    [](int i, int j, int k) {
+      glm::vec3 p = glm::vec3(i, j, k) - glm::vec3(dim * 0.5f);
+      return glm::length(p) - dim * 0.4f;
+    },
+    [](float x, float y, float z) {
+      return mesh_t::vertex_t(glm::vec3(x, y, z), glm::vec3(0, 0, 1), glm::vec2(0));
+    }
+  );
+  measure("marching cubes sphere", sphere);
+
+  if (!bench::forEachFbxMesh<mesh_t>(argc, argv, measure)) return 1;
+  return bench::finish(argc, argv, 0, bench::firstOption(argc, argv));
+}
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU parallel primitives against their std:: equivalents.
+//
+// Checks vku::Primitives scan, reduce, compaction and radix sort for correctness
+// and reports throughput of the GPU and CPU versions in millions of elements per second.
+//
+
+#include "bench.hpp"
+#include <vku/vku_primitives.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+// Time one GPU operation: record, submit and wait.
+template <class Fn>
+double gpuSeconds(bench::Context &ctx, vku::Primitives &prims, Fn fn) {
+  return bench::secondsPerCall([&]() {
+    vku::executeImmediately(ctx.device(), ctx.commandPool(), ctx.queue(), fn);
+    prims.beginFrame(0);
+  });
+}
+
+static void result(const std::string &variant, const std::string &name, bool ok, uint32_t count, double gpu, double cpu) {
+  std::string test = name + " n=" + std::to_string(count);
+  std::cout << test << ": " << (ok ? "ok" : "FAILED") << "\n";
+  bench::report(test + " gpu " + variant, count / gpu * 1e-6, "M/s");
+  bench::report(test + " std " + variant, count / cpu * 1e-6, "M/s");
+}
+
+static bool run(bench::Context &ctx, bool subgroups) {
+  vk::Device device = ctx.device();
+  vku::Primitives prims{device, ctx.memprops(), ctx.queueFamilyIndex(), BINARY_DIR, subgroups};
+  std::string variant = subgroups ? "subgroup" : "shared";
+  std::cout << (subgroups ? "subgroup kernels\n" : "shared memory kernels\n");
+
+  typedef vk::BufferUsageFlagBits buf;
+  auto usage = buf::eStorageBuffer|buf::eTransferSrc|buf::eTransferDst;
+  std::mt19937 rng(1234);
+  bool allOk = true;
+
+  for (uint32_t count : {1u << 12, 1u << 16, 1u << 20}) {
+    std::vector<uint32_t> values(count), flags(count), keys(count), indices(count);
+    for (uint32_t i = 0; i != count; ++i) {
+      values[i] = rng() & 0xffff;
+      flags[i] = rng() & 1;
+      keys[i] = rng();
+      indices[i] = i;
+    }
+
+    vku::GenericBuffer in(device, ctx.memprops(), usage, count * 4);
+    vku::GenericBuffer out(device, ctx.memprops(), usage, count * 4);
+    vku::GenericBuffer flagBuf(device, ctx.memprops(), usage, count * 4);
+    vku::GenericBuffer keyBuf(device, ctx.memprops(), usage, count * 4);
+    vku::GenericBuffer valueBuf(device, ctx.memprops(), usage, count * 4);
+    vku::GenericBuffer scalar(device, ctx.memprops(), usage, 4);
+    in.upload(device, ctx.memprops(), ctx.commandPool(), ctx.queue(), values);
+    flagBuf.upload(device, ctx.memprops(), ctx.commandPool(), ctx.queue(), flags);
+
+    // Exclusive scan.
+    std::vector<uint32_t> expected(count);
+    double cpu = bench::secondsPerCall([&]() {
+      uint32_t sum = 0;
+      for (uint32_t i = 0; i != count; ++i) { expected[i] = sum; sum += values[i]; }
+    });
+    double gpu = gpuSeconds(ctx, prims, [&](vk::CommandBuffer cb) { prims.exclusiveScan(cb, in, out, count); });
+    bool ok = bench::download<uint32_t>(ctx, out, count) == expected;
+    result(variant, "exclusiveScan", ok, count, gpu, cpu);
+    allOk = allOk && ok;
+
+    // Inclusive scan.
+    cpu = bench::secondsPerCall([&]() { std::partial_sum(values.begin(), values.end(), expected.begin()); });
+    gpu = gpuSeconds(ctx, prims, [&](vk::CommandBuffer cb) { prims.inclusiveScan(cb, in, out, count); });
+    ok = bench::download<uint32_t>(ctx, out, count) == expected;
+    result(variant, "inclusiveScan", ok, count, gpu, cpu);
+    allOk = allOk && ok;
+
+    // Reduction.
+    uint32_t total = 0;
+    cpu = bench::secondsPerCall([&]() { total = std::accumulate(values.begin(), values.end(), 0u); });
+    gpu = gpuSeconds(ctx, prims, [&](vk::CommandBuffer cb) { prims.reduce(cb, in, scalar, count); });
+    ok = bench::download<uint32_t>(ctx, scalar, 1)[0] == total;
+    result(variant, "reduce", ok, count, gpu, cpu);
+    allOk = allOk && ok;
+
+    // Stream compaction.
+    std::vector<uint32_t> kept;
+    cpu = bench::secondsPerCall([&]() {
+      kept.clear();
+      for (uint32_t i = 0; i != count; ++i) if (flags[i]) kept.push_back(values[i]);
+    });
+    gpu = gpuSeconds(ctx, prims, [&](vk::CommandBuffer cb) { prims.compact(cb, in, flagBuf, out, scalar, count); });
+    uint32_t numKept = bench::download<uint32_t>(ctx, scalar, 1)[0];
+    ok = numKept == kept.size() && bench::download<uint32_t>(ctx, out, numKept) == kept;
+    result(variant, "compact", ok, count, gpu, cpu);
+    allOk = allOk && ok;
+
+    // Key-value sort. Each timed GPU run sorts already sorted data, which costs the same.
+    std::vector<std::pair<uint32_t, uint32_t> > pairs(count), sorted;
+    for (uint32_t i = 0; i != count; ++i) pairs[i] = std::make_pair(keys[i], indices[i]);
+    cpu = bench::secondsPerCall([&]() {
+      sorted = pairs;
+      std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) { return a.first < b.first; });
+    });
+    keyBuf.upload(device, ctx.memprops(), ctx.commandPool(), ctx.queue(), keys);
+    valueBuf.upload(device, ctx.memprops(), ctx.commandPool(), ctx.queue(), indices);
+    vku::executeImmediately(device, ctx.commandPool(), ctx.queue(), [&](vk::CommandBuffer cb) { prims.sort(cb, keyBuf, valueBuf, count); });
+    prims.beginFrame(0);
+    auto gpuKeys = bench::download<uint32_t>(ctx, keyBuf, count);
+    auto gpuValues = bench::download<uint32_t>(ctx, valueBuf, count);
+    ok = true;
+    for (uint32_t i = 0; i != count; ++i) {
+      ok = ok && gpuKeys[i] == sorted[i].first && gpuValues[i] == sorted[i].second;
+    }
+    gpu = gpuSeconds(ctx, prims, [&](vk::CommandBuffer cb) { prims.sort(cb, keyBuf, valueBuf, count); });
+    result(variant, "sort", ok, count, gpu, cpu);
+    allOk = allOk && ok;
+  }
+  return allOk;
+}
+
+int main(int argc, char **argv) {
+  bench::Context ctx;
+  if (!ctx.ok()) {
+    std::cout << "No Vulkan device" << std::endl;
+    return 1;
+  }
+
+  bool ok = run(ctx, false);
+  if (vku::Primitives::subgroupsSupported(ctx.physicalDevice())) {
+    ok = run(ctx, true) && ok;
+  }
+  return bench::finish(argc, argv, ok ? 0 : 1);
+}
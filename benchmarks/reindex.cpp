@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vertex welding and normal recalculation of gilgamesh meshes (basic_mesh::reindex).
+//
+// Each mesh is expanded to one vertex per corner, as decoders produce it, and
+// welded back with and without recalculated normals, on one thread and on one
+// per core. FBX files named before the options are measured too:
+//
+//   bench-reindex model.fbx [--json results.json] [--compare baseline.json]
+//
+
+#include "bench.hpp"
+
+#include <gilgamesh/shapes/teapot.hpp>
+
+typedef gilgamesh::simple_mesh mesh_t;
+
+// Mean seconds per reindex, not counting the copy of the input.
+static double secondsPerReindex(const mesh_t &soup, bool recalcNormals, unsigned numThreads) {
+  typedef std::chrono::high_resolution_clock clock;
+  mesh_t mesh;
+  double elapsed = 0;
+  int calls = 0;
+  do {
+    mesh.vertices() = soup.vertices();
+    mesh.indices() = soup.indices();
+    auto start = clock::now();
+    mesh.reindex(recalcNormals, 0.0f, numThreads);
+    elapsed += std::chrono::duration<double>(clock::now() - start).count();
+    ++calls;
+  } while (elapsed < 0.25);
+  return elapsed / calls;
+}
+
+static void measure(const std::string &name, const mesh_t &mesh) {
+  mesh_t soup;
+  for (auto i : mesh.indices()) {
+    soup.addIndex(soup.addVertex(mesh.vertices()[i]));
+  }
+
+  size_t numTriangles = soup.indices().size() / 3;
+  std::cout << name << ": " << numTriangles << " triangles, " << mesh.vertices().size() << " vertices\n";
+  bench::forThreadCounts([&](unsigned threads, const std::string &suffix) {
+    bench::report(name + " weld" + suffix, secondsPerReindex(soup, false, threads) * 1e3, "ms");
+    bench::report(name + " weld and normals" + suffix, secondsPerReindex(soup, true, threads) * 1e3, "ms");
+  });
+}
+
+int main(int argc, char **argv) {
+  gilgamesh::teapot shape;
+  mesh_t teapot;
+  shape.build(teapot, glm::mat4{1}, glm::vec4{1}, 64);
+  measure("teapot 64", teapot);
+
+  // Marching cubes output, as made by the basic_mesh field constructor.
+  for (int dim : {64, 192}) {
+    mesh_t sphere(dim, dim, dim,
+      [dim](int i, int j, int k) {
+        glm::vec3 p = glm::vec3(i, j, k) - glm::vec3(dim * 0.5f);
+        return glm::length(p) - dim * 0.4f + 2.0f * std::sin(i * 0.3f) * std::cos(j * 0.2f);
+      },
+      [](float x, float y, float z) {
+        return mesh_t::vertex_t(glm::vec3(x, y, z), glm::vec3(0, 0, 1), glm::vec2(0));
+      }
+    );
+    measure("marching cubes " + std::to_string(dim), sphere);
+  }
+
+  if (!bench::forEachFbxMesh<mesh_t>(argc, argv, measure)) return 1;
+  return bench::finish(argc, argv, 0, bench::firstOption(argc, argv));
+}
@@ -0,0 +1,46 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Replay a trace written by vku::Capture and time each frame.
+//
+//   bench-replay frame.vkutrace [--json results.json] [--compare baseline.json]
+//
+// Frame times include repeating the frame's uploads. GPU times come from
+// timestamps around the frame's commands, where the queue has them.
+//
+
+#include "bench.hpp"
+#include <vku/vku_capture.hpp>
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argv[1][0] == '-') {
+    std::cerr << "usage: " << argv[0] << " trace.vkutrace [--json results.json] [--compare baseline.json] [--threshold 0.1]\n";
+    return 1;
+  }
+
+  bench::Context ctx;
+  if (!ctx.ok()) {
+    std::cout << "No Vulkan device" << std::endl;
+    return 1;
+  }
+
+  vku::CaptureReplay replay{ctx.device(), ctx.physicalDevice(), ctx.queueFamilyIndex(), argv[1]};
+  if (!replay.ok()) {
+    std::cerr << "could not load " << argv[1] << "\n";
+    return 1;
+  }
+  std::cout << argv[1] << ": " << replay.numFrames() << " frames, " << replay.numBuffers() << " buffers, " << replay.numKernels() << " kernels\n";
+
+  for (size_t frame = 0; frame != replay.numFrames(); ++frame) {
+    double t = bench::secondsPerCall([&]() {
+      replay.run(ctx.queue(), frame);
+    });
+    std::string name = "frame " + std::to_string(frame);
+    bench::report(name, t * 1e3, "ms");
+    if (replay.gpuMs(frame) >= 0) {
+      bench::report(name + " gpu", replay.gpuMs(frame), "ms");
+    }
+  }
+
+  // The options after the trace name.
+  return bench::finish(argc, argv, 0, 2);
+}
@@ -1,6 +1,7 @@
 
 #include <vku/vku_framework.hpp>
 #include <vku/vku.hpp>
+#include <vku/vku_mesh.hpp>
 #include <glm/glm.hpp>
 #define GLM_ENABLE_EXPERIMENTAL 1
 #include <glm/gtx/io.hpp>
@@ -59,23 +60,19 @@ int main() {
     shape.build(mesh);
     mesh.reindex(true);
 
-    struct Vertex { glm::vec3 pos; glm::vec3 normal; glm::vec2 uv; };
-    std::vector<Vertex> vertices;
-
-    auto meshpos = mesh.pos();
-    auto meshnormal = mesh.normal();
-    auto meshuv = mesh.uv(0);
-    for (size_t i = 0; i != meshpos.size(); ++i) {
-      glm::vec3 pos = meshpos[i];
-      glm::vec3 normal = meshnormal[i];
-      glm::vec2 uv = meshuv[i];
-      vertices.emplace_back(Vertex{pos, normal, uv});
-    }
-    std::vector<uint32_t> indices = mesh.indices32();
+    // Order the triangles for the vertex cache and overdraw.
+    mesh.optimize();
+
+    // Pack the indices first: meshes with more than 65535 vertices are split into chunks,
+    // which reorders the vertices.
+    vku::PackedIndices indices = vku::IndexPacker{}.pack(mesh);
+
+    // Pack the vertices into 16 bytes: unorm16 positions, 10 bit normals and half float uvs.
+    // The positions are relative to the bounding box, so the model matrix includes positionTransform().
+    vku::PackedVertices vertices = vku::VertexPacker{}.physicalDevice(fw.physicalDevice()).pack(mesh);
 
-    vku::HostVertexBuffer vbo(fw.device(), fw.memprops(), vertices);
-    vku::HostIndexBuffer ibo(fw.device(), fw.memprops(), indices);
-    uint32_t indexCount = (uint32_t)indices.size();
+    vku::HostVertexBuffer vbo(fw.device(), fw.memprops(), vertices.data());
+    vku::HostIndexBuffer ibo(fw.device(), fw.memprops(), indices.data());
 
     struct Uniform {
       glm::mat4 modelToPerspective;
@@ -129,10 +126,8 @@ int main() {
     vku::PipelineMaker pm{window.width(), window.height()};
     pm.shader(vk::ShaderStageFlagBits::eVertex, final_vert);
     pm.shader(vk::ShaderStageFlagBits::eFragment, final_frag);
-    pm.vertexBinding(0, (uint32_t)sizeof(Vertex));
-    pm.vertexAttribute(0, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, pos));
-    pm.vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, normal));
-    pm.vertexAttribute(2, 0, vk::Format::eR32G32Sfloat, (uint32_t)offsetof(Vertex, uv));
+    vertices.vertexAttributes(pm);
+    indices.inputAssembly(pm);
     pm.depthTestEnable(VK_TRUE);
     pm.cullMode(vk::CullModeFlagBits::eBack);
     pm.frontFace(vk::FrontFace::eCounterClockwise);
@@ -151,10 +146,8 @@ int main() {
     vku::PipelineMaker spm{shadowSize, shadowSize};
     spm.shader(vk::ShaderStageFlagBits::eVertex, shadow_vert);
     spm.shader(vk::ShaderStageFlagBits::eFragment, shadow_frag);
-    spm.vertexBinding(0, (uint32_t)sizeof(Vertex));
-    spm.vertexAttribute(0, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, pos));
-    spm.vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, normal));
-    spm.vertexAttribute(2, 0, vk::Format::eR32G32Sfloat, (uint32_t)offsetof(Vertex, uv));
+    vertices.vertexAttributes(spm);
+    indices.inputAssembly(spm);
 
     // Shadows render only to the depth buffer
     // Depth test is important.
@@ -304,10 +297,11 @@ int main() {
         [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
           Uniform uniform{};
           modelToWorld = glm::rotate(modelToWorld, glm::radians(1.0f), glm::vec3(0, 0, 1));
-          uniform.modelToPerspective = cameraToPerspective * worldToCamera * modelToWorld;
+          glm::mat4 packedToWorld = modelToWorld * vertices.positionTransform();
+          uniform.modelToPerspective = cameraToPerspective * worldToCamera * packedToWorld;
           uniform.normalToWorld = modelToWorld;
-          uniform.modelToWorld = modelToWorld;
-          uniform.modelToLight = lightToPerspective * worldToLight * modelToWorld;
+          uniform.modelToWorld = packedToWorld;
+          uniform.modelToLight = lightToPerspective * worldToLight * packedToWorld;
           uniform.lightPos = lightToWorld[3];
           uniform.cameraPos = cameraToWorld[3];
 
@@ -323,19 +317,19 @@ int main() {
           cb.beginRenderPass(shadowRpbi, vk::SubpassContents::eInline);
           cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *shadowPipeline);
           cb.bindVertexBuffers(0, vbo.buffer(), vk::DeviceSize(0));
-          cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), vk::IndexType::eUint32);
+          cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), indices.indexType());
           cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, descriptorSets, nullptr);
           cb.setDepthBias(depthBiasConstantFactor, 0.0f, depthBiasSlopeFactor);
-          cb.drawIndexed(indexCount, 1, 0, 0, 0);
+          indices.draw(cb);
           cb.endRenderPass();
 
           // Second renderpass. Draw the final image.
           cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
           cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *finalPipeline);
           cb.bindVertexBuffers(0, vbo.buffer(), vk::DeviceSize(0));
-          cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), vk::IndexType::eUint32);
+          cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), indices.indexType());
           cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, descriptorSets, nullptr);
-          cb.drawIndexed(indexCount, 1, 0, 0, 0);
+          indices.draw(cb);
           cb.endRenderPass();
 
           cb.end();
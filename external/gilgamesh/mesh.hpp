@@ -16,6 +16,9 @@
 #include <ostream>
 #include <algorithm>
 #include <memory>
+#include <limits>
+#include <queue>
+#include <thread>
 #include <stdio.h>
 
 namespace gilgamesh {
@@ -196,61 +199,646 @@ public:
     return MeshTraits::getFormat();
   }
 
-  void reindex(bool recalcNormals = false) {
-    if (recalcNormals) {
-      // zero all normals
-      for (size_t i = 0; i < vertices_.size(); ++i) {
-        vertices_[i].normal(glm::vec3(0, 0, 0));
-      }
-
-      // accumulate normals on shared vertices
-      for (size_t i = 0; i+2 < indices_.size(); i += 3) {
-        size_t i0 = indices_[i+0];
-        size_t i1 = indices_[i+1];
-        size_t i2 = indices_[i+2];
-        auto &v0 = vertices_[i0];
-        auto &v1 = vertices_[i1];
-        auto &v2 = vertices_[i2];
-        glm::vec3 p0 = v0.pos();
-        glm::vec3 p1 = v1.pos();
-        glm::vec3 p2 = v2.pos();
-        glm::vec3 normal = glm::normalize(glm::cross(p1-p0, p2-p0));
-        v0.normal(v0.normal() + normal);
-        v1.normal(v1.normal() + normal);
-        v2.normal(v2.normal() + normal);
-      }
-    }
-
-    std::vector<expandedVertex> expanded = expand();
-    if (recalcNormals) {
-      std::sort(
-        expanded.begin(), expanded.end(),
-        [](const expandedVertex &a, const expandedVertex &b) {
-          glm::vec3 apos = a.vtx.pos();
-          glm::vec3 bpos = b.vtx.pos();
-          return memcmp(&apos, &bpos, sizeof(apos)) < 0;
+  // Merge identical vertices and remove unused ones, numbering vertices in order of first use.
+  // With recalcNormals, normals are recalculated from the triangles and averaged over all the
+  // vertices at each position. With epsilon, positions that round to the same multiple of
+  // epsilon are first snapped to one of them. Vertices are matched with hash tables and
+  // normals accumulated on numThreads threads, by default one per core.
+  void reindex(bool recalcNormals = false, float epsilon = 0.0f, unsigned numThreads = 0) {
+    const uint32_t none = ~(uint32_t)0;
+    size_t numVertices = vertices_.size();
+    size_t numTriangles = indices_.size() / 3;
+    if (numThreads == 0) numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (numTriangles < 65536) numThreads = 1;
+
+    if (recalcNormals || epsilon > 0) {
+      // The first vertex at each position.
+      std::vector<uint32_t> first(numVertices);
+      std::vector<uint32_t> table(hashTableSize(numVertices), none);
+      for (size_t v = 0; v != numVertices; ++v) {
+        glm::vec3 pos = vertices_[v].pos();
+        if (epsilon > 0) {
+          glm::ivec3 cell = glm::ivec3(glm::round(pos / epsilon));
+          first[v] = hashInsert(table, hashBytes(&cell, sizeof(cell)), (uint32_t)v, [&](uint32_t u) {
+            return glm::ivec3(glm::round(vertices_[u].pos() / epsilon)) == cell;
+          });
+          vertices_[v].pos(vertices_[first[v]].pos());
+        } else {
+          first[v] = hashInsert(table, hashBytes(&pos, sizeof(pos)), (uint32_t)v, [&](uint32_t u) {
+            glm::vec3 upos = vertices_[u].pos();
+            return memcmp(&upos, &pos, sizeof(pos)) == 0;
+          });
         }
-      );
-
-      size_t imax = expanded.size();
-      for (size_t i = 0, idx = 0; i != imax; ) {
-        auto &v0 = expanded[i];
-        glm::vec3 normal = v0.vtx.normal();
-        glm::vec3 pos = v0.vtx.pos();
-        size_t j = i + 1;
-        for (; j < imax && pos == expanded[j].vtx.pos(); ++j) {
-          normal += expanded[j].vtx.normal();
+      }
+
+      if (recalcNormals) {
+        std::vector<glm::vec3> faceNormals(numTriangles);
+        parallelFor(numTriangles, numThreads, [&](size_t begin, size_t end) {
+          for (size_t t = begin; t != end; ++t) {
+            glm::vec3 p0 = vertices_[indices_[t * 3 + 0]].pos();
+            glm::vec3 p1 = vertices_[indices_[t * 3 + 1]].pos();
+            glm::vec3 p2 = vertices_[indices_[t * 3 + 2]].pos();
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float len = glm::length(n);
+            faceNormals[t] = len > 0 ? n / len : glm::vec3(0);
+          }
+        });
+
+        // Triangles at each position: corners[offsets[v]..offsets[v+1]] for first vertices v.
+        std::vector<uint32_t> offsets(numVertices + 1, 0);
+        for (size_t i = 0; i != numTriangles * 3; ++i) {
+          offsets[first[indices_[i]] + 1]++;
+        }
+        for (size_t v = 0; v != numVertices; ++v) {
+          offsets[v + 1] += offsets[v];
+        }
+        std::vector<uint32_t> corners(numTriangles * 3);
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i != numTriangles * 3; ++i) {
+          corners[fill[first[indices_[i]]]++] = (uint32_t)(i / 3);
+        }
+
+        // Each thread sums the positions of a range of first vertices, so none share a total.
+        std::vector<glm::vec3> normals(numVertices);
+        parallelFor(numVertices, numThreads, [&](size_t begin, size_t end) {
+          for (size_t v = begin; v != end; ++v) {
+            glm::vec3 sum(0);
+            for (size_t c = offsets[v]; c != offsets[v + 1]; ++c) {
+              sum += faceNormals[corners[c]];
+            }
+            float len = glm::length(sum);
+            normals[v] = len > 0 ? sum / len : glm::vec3(0);
+          }
+        });
+        parallelFor(numVertices, numThreads, [&](size_t begin, size_t end) {
+          for (size_t v = begin; v != end; ++v) {
+            vertices_[v].normal(normals[first[v]]);
+          }
+        });
+      }
+    }
+
+    // Weld vertices with identical bytes.
+    std::vector<uint32_t> remap(numVertices, none);
+    std::vector<uint32_t> table(hashTableSize(numVertices), none);
+    std::vector<vertex_t> vertices;
+    vertices.reserve(numVertices);
+    for (auto &i : indices_) {
+      uint32_t &r = remap[i];
+      if (r == none) {
+        const vertex_t &vtx = vertices_[i];
+        r = hashInsert(table, hashBytes(&vtx, sizeof(vtx)), (uint32_t)vertices.size(), [&](uint32_t u) {
+          return memcmp(&vertices[u], &vtx, sizeof(vtx)) == 0;
+        });
+        if (r == vertices.size()) vertices.push_back(vtx);
+      }
+      i = (index_t)r;
+    }
+    vertices_.swap(vertices);
+  }
+
+  // Post transform vertex cache statistics, simulating a FIFO cache of cacheSize vertices.
+  // acmr: vertices transformed per triangle, 3 with no reuse and about 0.5 at best.
+  // atvr: vertices transformed per vertex used, 1 at best.
+  struct cache_stats {
+    float acmr;
+    float atvr;
+  };
+
+  cache_stats cacheStats(int cacheSize = 16) const {
+    std::vector<size_t> timestamps(vertices_.size(), 0);
+    std::vector<bool> used(vertices_.size(), false);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+    size_t numUsed = 0;
+    for (auto i : indices_) {
+      if (time - timestamps[i] > (size_t)cacheSize) {
+        timestamps[i] = time++;
+        ++misses;
+      }
+      if (!used[i]) {
+        used[i] = true;
+        ++numUsed;
+      }
+    }
+    size_t numTriangles = indices_.size() / 3;
+    return cache_stats{
+      numTriangles ? (float)misses / numTriangles : 0.0f,
+      numUsed ? (float)misses / numUsed : 0.0f
+    };
+  }
+
+  // Reorder the triangles for the vertex cache, then for overdraw, then renumber the
+  // vertices in the order they are fetched. Unused vertices are removed.
+  void optimize(int cacheSize = 16, float overdrawThreshold = 1.05f) {
+    std::vector<size_t> clusters;
+    optimizeVertexCache(cacheSize, &clusters);
+    optimizeOverdraw(clusters, cacheSize, overdrawThreshold);
+    optimizeVertexFetch();
+  }
+
+  // Reorder triangles for a post transform cache of cacheSize vertices.
+  // This is Tipsify from Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+  // Locality and Reduced Overdraw", 2007. It fans around one vertex at a time, choosing the
+  // next fan from the vertices just used that will still be in the cache.
+  // If clusters is not null, it gets the first triangle of each run between cache flushes.
+  void optimizeVertexCache(int cacheSize = 16, std::vector<size_t> *clusters = nullptr) {
+    const size_t none = ~(size_t)0;
+    size_t numVertices = vertices_.size();
+    size_t numTriangles = indices_.size() / 3;
+    if (clusters) clusters->clear();
+
+    // Triangles using each vertex: adjacency[offsets[v]..offsets[v+1]]
+    std::vector<size_t> offsets(numVertices + 1, 0);
+    for (size_t i = 0; i != numTriangles * 3; ++i) {
+      offsets[indices_[i] + 1]++;
+    }
+    for (size_t v = 0; v != numVertices; ++v) {
+      offsets[v + 1] += offsets[v];
+    }
+    std::vector<size_t> adjacency(numTriangles * 3);
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i != numTriangles * 3; ++i) {
+      adjacency[fill[indices_[i]]++] = i / 3;
+    }
+
+    // Triangles not yet emitted for each vertex.
+    std::vector<size_t> live(numVertices);
+    for (size_t v = 0; v != numVertices; ++v) {
+      live[v] = offsets[v + 1] - offsets[v];
+    }
+
+    std::vector<size_t> timestamps(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<size_t> deadEnd;
+    std::vector<size_t> candidates;
+    std::vector<index_t> result;
+    result.reserve(indices_.size());
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;
+
+    // Go back to a recently used vertex, or the next one in input order.
+    auto skipDeadEnd = [&]() -> size_t {
+      while (!deadEnd.empty()) {
+        size_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (live[v]) return v;
+      }
+      for (; cursor != numVertices; ++cursor) {
+        if (live[cursor]) return cursor;
+      }
+      return none;
+    };
+
+    size_t fan = skipDeadEnd();
+    bool flushed = true;
+    while (fan != none) {
+      if (flushed && clusters) clusters->push_back(result.size() / 3);
+
+      // Emit all the remaining triangles around the fan vertex.
+      candidates.clear();
+      for (size_t a = offsets[fan]; a != offsets[fan + 1]; ++a) {
+        size_t t = adjacency[a];
+        if (emitted[t]) continue;
+        emitted[t] = true;
+        for (size_t c = 0; c != 3; ++c) {
+          size_t v = indices_[t * 3 + c];
+          result.push_back(indices_[t * 3 + c]);
+          deadEnd.push_back(v);
+          candidates.push_back(v);
+          live[v]--;
+          if (time - timestamps[v] > (size_t)cacheSize) {
+            timestamps[v] = time++;
+          }
+        }
+      }
+
+      // Prefer the oldest candidate that will still be in the cache after its own fan.
+      // Candidates that would drop out of it (priority 0) are left for the dead-end stack.
+      size_t next = none;
+      size_t best = 0;
+      for (auto v : candidates) {
+        if (!live[v]) continue;
+        size_t priority = 0;
+        if (time - timestamps[v] + 2 * live[v] <= (size_t)cacheSize) {
+          priority = time - timestamps[v];
+        }
+        if (priority > best) {
+          best = priority;
+          next = v;
         }
+      }
+
+      flushed = next == none;
+      fan = flushed ? skipDeadEnd() : next;
+    }
 
-        normal = glm::normalize(normal);
+    // Keep any incomplete triangle at the end.
+    result.insert(result.end(), indices_.begin() + numTriangles * 3, indices_.end());
+    indices_.swap(result);
+  }
+
+  // Sort clusters of triangles so that those facing out from the middle of the mesh draw
+  // first and hide what is behind them.
+  // The clusters from optimizeVertexCache() are split further while the cache miss rate
+  // of the pieces stays within threshold times that of the whole cluster.
+  void optimizeOverdraw(const std::vector<size_t> &cacheClusters, int cacheSize = 16, float threshold = 1.05f) {
+    size_t numTriangles = indices_.size() / 3;
+    if (numTriangles == 0) return;
+
+    std::vector<size_t> timestamps(vertices_.size(), 0);
+    size_t time = cacheSize + 1;
+    auto flush = [&]() { time += cacheSize + 1; };
+    auto misses = [&](size_t t) -> size_t {
+      size_t result = 0;
+      for (size_t c = 0; c != 3; ++c) {
+        size_t v = indices_[t * 3 + c];
+        if (time - timestamps[v] > (size_t)cacheSize) {
+          timestamps[v] = time++;
+          ++result;
+        }
+      }
+      return result;
+    };
 
-        while (i < j) {
-          expanded[i++].vtx.normal(normal);
+    std::vector<size_t> hard = cacheClusters;
+    if (hard.empty() || hard[0] != 0) hard.insert(hard.begin(), 0);
+
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h != hard.size(); ++h) {
+      size_t begin = hard[h];
+      size_t end = h + 1 != hard.size() ? hard[h + 1] : numTriangles;
+      if (begin >= end) continue;
+
+      flush();
+      size_t total = 0;
+      for (size_t t = begin; t != end; ++t) total += misses(t);
+      float limit = threshold * total / (end - begin);
+
+      flush();
+      clusters.push_back(begin);
+      size_t start = begin;
+      size_t run = 0;
+      for (size_t t = begin; t != end; ++t) {
+        run += misses(t);
+        if (t + 1 != end && (float)run / (t + 1 - start) <= limit) {
+          clusters.push_back(t + 1);
+          start = t + 1;
+          run = 0;
+          flush();
         }
       }
     }
 
-    compact(expanded);
+    // Area weighted centroid and normal of each cluster and the centroid of the mesh.
+    struct cluster {
+      size_t begin;
+      size_t end;
+      glm::vec3 centroid;
+      glm::vec3 normal;
+      float sortKey;
+    };
+
+    std::vector<cluster> sorted;
+    glm::vec3 meshCentroid(0);
+    float meshArea = 0;
+    for (size_t c = 0; c != clusters.size(); ++c) {
+      cluster cl{clusters[c], c + 1 != clusters.size() ? clusters[c + 1] : numTriangles, glm::vec3(0), glm::vec3(0), 0};
+      float area = 0;
+      glm::vec3 sum(0);
+      for (size_t t = cl.begin; t != cl.end; ++t) {
+        glm::vec3 p0 = vertices_[indices_[t * 3 + 0]].pos();
+        glm::vec3 p1 = vertices_[indices_[t * 3 + 1]].pos();
+        glm::vec3 p2 = vertices_[indices_[t * 3 + 2]].pos();
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float a = glm::length(n);
+        cl.normal += n;
+        cl.centroid += (p0 + p1 + p2) * (a / 3);
+        sum += (p0 + p1 + p2) * (1.0f / 3);
+        area += a;
+      }
+      meshCentroid += cl.centroid;
+      meshArea += area;
+      cl.centroid = area > 0 ? cl.centroid / area : sum / (float)(cl.end - cl.begin);
+      sorted.push_back(cl);
+    }
+    if (meshArea > 0) meshCentroid /= meshArea;
+
+    for (auto &cl : sorted) {
+      float len = glm::length(cl.normal);
+      cl.sortKey = len > 0 ? glm::dot(cl.centroid - meshCentroid, cl.normal / len) : 0;
+    }
+
+    std::stable_sort(
+      sorted.begin(), sorted.end(),
+      [](const cluster &a, const cluster &b) {
+        return a.sortKey > b.sortKey;
+      }
+    );
+
+    std::vector<index_t> result;
+    result.reserve(indices_.size());
+    for (auto &cl : sorted) {
+      result.insert(result.end(), indices_.begin() + cl.begin * 3, indices_.begin() + cl.end * 3);
+    }
+    result.insert(result.end(), indices_.begin() + numTriangles * 3, indices_.end());
+    indices_.swap(result);
+  }
+
+  // Renumber the vertices in the order the indices use them so that vertex fetches
+  // go through memory in order. Vertices that are not used are removed.
+  void optimizeVertexFetch() {
+    const size_t none = ~(size_t)0;
+    std::vector<size_t> remap(vertices_.size(), none);
+    std::vector<vertex_t> vertices;
+    vertices.reserve(vertices_.size());
+    for (auto &i : indices_) {
+      if (remap[i] == none) {
+        remap[i] = vertices.size();
+        vertices.push_back(vertices_[i]);
+      }
+      i = (index_t)remap[i];
+    }
+    vertices_.swap(vertices);
+  }
+
+  // One level of detail from simplify(): triangles using the mesh's vertices, and an
+  // estimate of their distance from the original surface in the units of the positions.
+  struct lod {
+    std::vector<index_t> indices;
+    float error;
+  };
+
+  // Simplify by collapsing edges onto existing vertices in order of quadric error (Garland and
+  // Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997) so that every level
+  // shares the vertex array. Returns a level for each of the decreasing target triangle counts,
+  // stopping early with the last level reached if no collapse has an error within maxError.
+  // Vertices that share a position collapse together, so seams move only along the seam.
+  // Open borders collapse only along the border.
+  std::vector<lod> simplify(const std::vector<size_t> &targetTriangles, float maxError = std::numeric_limits<float>::max()) const {
+    const uint32_t none = ~(uint32_t)0;
+    size_t numVertices = vertices_.size();
+    size_t numTriangles = indices_.size() / 3;
+    std::vector<lod> result;
+
+    // Group vertices by position. Collapses move all the vertices of a group.
+    std::vector<uint32_t> order(numVertices);
+    for (size_t v = 0; v != numVertices; ++v) order[v] = (uint32_t)v;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+      glm::vec3 apos = vertices_[a].pos();
+      glm::vec3 bpos = vertices_[b].pos();
+      return memcmp(&apos, &bpos, sizeof(apos)) < 0;
+    });
+    std::vector<uint32_t> groupOf(numVertices);
+    std::vector<glm::vec3> groupPos;
+    for (size_t i = 0; i != numVertices; ++i) {
+      glm::vec3 pos = vertices_[order[i]].pos();
+      if (i == 0 || pos != groupPos.back()) groupPos.push_back(pos);
+      groupOf[order[i]] = (uint32_t)groupPos.size() - 1;
+    }
+    size_t numGroups = groupPos.size();
+
+    // Triangles with three different positions, and the triangles of each group.
+    std::vector<uint32_t> tris(indices_.begin(), indices_.begin() + numTriangles * 3);
+    std::vector<bool> removed(numTriangles, false);
+    std::vector<std::vector<uint32_t>> groupTris(numGroups);
+    size_t liveTriangles = 0;
+    for (size_t t = 0; t != numTriangles; ++t) {
+      uint32_t g0 = groupOf[tris[t * 3 + 0]], g1 = groupOf[tris[t * 3 + 1]], g2 = groupOf[tris[t * 3 + 2]];
+      if (g0 == g1 || g1 == g2 || g2 == g0) {
+        removed[t] = true;
+        continue;
+      }
+      groupTris[g0].push_back((uint32_t)t);
+      groupTris[g1].push_back((uint32_t)t);
+      groupTris[g2].push_back((uint32_t)t);
+      ++liveTriangles;
+    }
+
+    // Area weighted plane quadrics: the error at p is p.A.p + 2 b.p + c divided by the weight.
+    struct quadric {
+      double a00, a01, a02, a11, a12, a22, b0, b1, b2, c, weight;
+
+      void addPlane(const glm::vec3 &n, float d, double w) {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+        b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+        c += w * d * d;
+        weight += w;
+      }
+
+      void add(const quadric &q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; weight += q.weight;
+      }
+
+      double error(const glm::vec3 &p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z + b0 * x + b1 * y + b2 * z) + c;
+        return weight > 0 ? std::max(e, 0.0) / weight : 0;
+      }
+    };
+
+    std::vector<quadric> quadrics(numGroups, quadric{});
+    std::vector<std::pair<uint64_t, uint32_t>> edges;
+    for (size_t t = 0; t != numTriangles; ++t) {
+      if (removed[t]) continue;
+      glm::vec3 p0 = groupPos[groupOf[tris[t * 3 + 0]]];
+      glm::vec3 p1 = groupPos[groupOf[tris[t * 3 + 1]]];
+      glm::vec3 p2 = groupPos[groupOf[tris[t * 3 + 2]]];
+      glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+      float len = glm::length(n);
+      if (len == 0) continue;
+      n /= len;
+      for (int c = 0; c != 3; ++c) {
+        uint32_t g = groupOf[tris[t * 3 + c]];
+        quadrics[g].addPlane(n, -glm::dot(n, p0), len * 0.5);
+        uint32_t h = groupOf[tris[t * 3 + (c + 1) % 3]];
+        edges.emplace_back((uint64_t)std::min(g, h) << 32 | std::max(g, h), (uint32_t)t);
+      }
+    }
+
+    // Planes through open border edges, perpendicular to the surface, keep borders in place.
+    std::vector<bool> border(numGroups, false);
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i != edges.size(); ) {
+      size_t j = i + 1;
+      while (j != edges.size() && edges[j].first == edges[i].first) ++j;
+      if (j == i + 1) {
+        uint32_t g = (uint32_t)(edges[i].first >> 32), h = (uint32_t)edges[i].first;
+        size_t t = edges[i].second;
+        glm::vec3 p0 = groupPos[groupOf[tris[t * 3 + 0]]];
+        glm::vec3 p1 = groupPos[groupOf[tris[t * 3 + 1]]];
+        glm::vec3 p2 = groupPos[groupOf[tris[t * 3 + 2]]];
+        glm::vec3 edge = groupPos[h] - groupPos[g];
+        glm::vec3 n = glm::cross(edge, glm::cross(p1 - p0, p2 - p0));
+        float len = glm::length(n);
+        if (len > 0) {
+          n /= len;
+          double w = 10.0 * glm::dot(edge, edge);
+          quadrics[g].addPlane(n, -glm::dot(n, groupPos[g]), w);
+          quadrics[h].addPlane(n, -glm::dot(n, groupPos[h]), w);
+        }
+        border[g] = border[h] = true;
+      }
+      i = j;
+    }
+
+    // Candidate collapses u -> v, cheapest first. Entries are stale once either group has changed.
+    struct collapse {
+      double cost;
+      uint32_t u, v, uVersion, vVersion;
+      bool operator<(const collapse &rhs) const { return cost > rhs.cost; }
+    };
+    std::priority_queue<collapse> queue;
+    std::vector<uint32_t> versions(numGroups, 0);
+    std::vector<bool> alive(numGroups, true);
+    std::vector<uint32_t> neighbours;
+
+    auto groupNeighbours = [&](uint32_t g) {
+      neighbours.clear();
+      for (auto t : groupTris[g]) {
+        if (removed[t]) continue;
+        for (int c = 0; c != 3; ++c) {
+          uint32_t h = groupOf[tris[t * 3 + c]];
+          if (h != g && std::find(neighbours.begin(), neighbours.end(), h) == neighbours.end()) neighbours.push_back(h);
+        }
+      }
+    };
+
+    auto push = [&](uint32_t u, uint32_t v) {
+      quadric q = quadrics[u];
+      q.add(quadrics[v]);
+      queue.push(collapse{q.error(groupPos[v]), u, v, versions[u], versions[v]});
+    };
+
+    for (uint32_t g = 0; g != numGroups; ++g) {
+      groupNeighbours(g);
+      for (auto h : neighbours) push(g, h);
+    }
+
+    // The vertex of v each vertex of u moves to.
+    std::vector<std::pair<uint32_t, uint32_t>> moves;
+    auto moveTo = [&](uint32_t vertex) {
+      for (auto &m : moves) if (m.first == vertex) return m.second;
+      return none;
+    };
+
+    auto valid = [&](uint32_t u, uint32_t v) {
+      // Each vertex of u must have an edge to a vertex of v, which keeps seams intact.
+      moves.clear();
+      size_t shared = 0;
+      for (auto t : groupTris[u]) {
+        if (removed[t]) continue;
+        uint32_t uc = none, vc = none;
+        for (int c = 0; c != 3; ++c) {
+          uint32_t g = groupOf[tris[t * 3 + c]];
+          if (g == u) uc = tris[t * 3 + c];
+          if (g == v) vc = tris[t * 3 + c];
+        }
+        if (vc == none) continue;
+        ++shared;
+        uint32_t to = moveTo(uc);
+        if (to == none) {
+          moves.emplace_back(uc, vc);
+        } else if (to != vc) {
+          return false;
+        }
+      }
+      if (shared == 0 || (border[u] && shared != 1)) return false;
+
+      // Only the vertices opposite the edge may neighbour both, or the surface would pinch.
+      groupNeighbours(v);
+      std::vector<uint32_t> vNeighbours = neighbours;
+      groupNeighbours(u);
+      size_t common = 0;
+      for (auto h : neighbours) common += std::find(vNeighbours.begin(), vNeighbours.end(), h) != vNeighbours.end();
+      if (common != shared) return false;
+
+      // The triangles that remain must have a moved vertex and must not flip over.
+      for (auto t : groupTris[u]) {
+        if (removed[t]) continue;
+        glm::vec3 p[3], q[3];
+        bool keep = true;
+        for (int c = 0; c != 3; ++c) {
+          uint32_t vertex = tris[t * 3 + c];
+          uint32_t g = groupOf[vertex];
+          if (g == v) keep = false;
+          if (g == u && moveTo(vertex) == none) return false;
+          p[c] = groupPos[g];
+          q[c] = g == u ? groupPos[v] : p[c];
+        }
+        if (!keep) continue;
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0) return false;
+      }
+      return true;
+    };
+
+    // Record a level with the surviving triangles in their original order.
+    double worst = 0;
+    auto snapshot = [&]() {
+      lod level;
+      level.indices.reserve(liveTriangles * 3);
+      for (size_t t = 0; t != numTriangles; ++t) {
+        if (removed[t]) continue;
+        for (int c = 0; c != 3; ++c) level.indices.push_back((index_t)tris[t * 3 + c]);
+      }
+      level.error = (float)std::sqrt(worst);
+      result.push_back(std::move(level));
+    };
+
+    double maxCost = (double)maxError * maxError;
+    for (auto target : targetTriangles) {
+      while (liveTriangles > target && !queue.empty()) {
+        collapse c = queue.top();
+        if (c.cost > maxCost) break;
+        queue.pop();
+        if (!alive[c.u] || !alive[c.v] || versions[c.u] != c.uVersion || versions[c.v] != c.vVersion) continue;
+        if (!valid(c.u, c.v)) continue;
+
+        for (auto t : groupTris[c.u]) {
+          if (removed[t]) continue;
+          bool onEdge = false;
+          for (int k = 0; k != 3; ++k) {
+            if (groupOf[tris[t * 3 + k]] == c.v) onEdge = true;
+          }
+          if (onEdge) {
+            removed[t] = true;
+            --liveTriangles;
+            continue;
+          }
+          for (int k = 0; k != 3; ++k) {
+            uint32_t &vertex = tris[t * 3 + k];
+            if (groupOf[vertex] == c.u) vertex = moveTo(vertex);
+          }
+          groupTris[c.v].push_back(t);
+        }
+        groupTris[c.u].clear();
+        auto &vt = groupTris[c.v];
+        vt.erase(std::remove_if(vt.begin(), vt.end(), [&removed](uint32_t t) { return removed[t]; }), vt.end());
+
+        quadrics[c.v].add(quadrics[c.u]);
+        alive[c.u] = false;
+        ++versions[c.v];
+        worst = std::max(worst, c.cost);
+
+        groupNeighbours(c.v);
+        for (auto h : neighbours) {
+          push(c.v, h);
+          push(h, c.v);
+        }
+      }
+
+      if (liveTriangles > target) {
+        // No more collapses: finish with what we have unless it is the last level.
+        if (result.empty() || result.back().indices.size() > liveTriangles * 3) snapshot();
+        break;
+      }
+      snapshot();
+    }
+    return result;
   }
 
   basic_mesh(std::vector<glm::vec3> &pos, std::vector<glm::vec3> &normal, std::vector<glm::vec2> &uv, std::vector<glm::vec4> &color, std::vector<uint32_t> &indices) {
@@ -267,8 +855,15 @@ public:
 
   // Generate an implicit basic_mesh from a function (ie. marching cubes).
   // Vertices will be generated where the function changes sign.
+  //
+  // fn is either fn(i, j, k), the value at one grid point, or fn(i, j, k, count, values),
+  // which writes the values at (i, j, k) ... (i + count - 1, j, k) so that a whole row
+  // can be evaluated several SIMD lanes at a time.
+  // The grid is split into slabs in z, one per thread (by default one per core). fn and
+  // vertex_generator are called concurrently and must give the same result for the same
+  // arguments. The mesh is the same for any number of threads.
   template<class Function, class Generator>
-  basic_mesh(int xdim, int ydim, int zdim, Function fn, Generator vertex_generator) {
+  basic_mesh(int xdim, int ydim, int zdim, Function fn, Generator vertex_generator, unsigned numThreads = 0) {
     // Now build the marching cubes triangles.
 
     // This reproduced the vertex order of Paul Bourke's (borrowed) table.
@@ -287,95 +882,89 @@ public:
     int dy = xdim * 3;
     int dz = xdim * ydim * 3;
     int vdz = xdim * ydim;
-    int vertex_index = (int)vertices_.size();
-        
-    // Each cube owns three edges 0->1 0->3 0->4
-    // We need two slices of cube edges to make all the cubes in a slice.
-    std::vector<int> edge_indices(dz*2);
+    if (zdim <= 0) return;
+
+    if (numThreads == 0) numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if ((size_t)vdz * zdim < 65536) numThreads = 1;
+    int numSlabs = (int)std::min((unsigned)zdim, numThreads);
+
+    // Each slab owns the vertices of its slices of the grid and the cubes above them.
+    // The top cubes of a slab use edges of the first slice of the next slab; these are
+    // stored as -2 - (edge offset) and renumbered when the slabs are joined.
+    struct slab {
+      std::vector<vertex_t> vertices;
+      std::vector<int> indices;
+      std::vector<int> first_edges;
+    };
+    std::vector<slab> slabs(numSlabs);
 
-    // We need three slices in values[]
-    std::vector<float> values(vdz * 3);
-    float *valm1 = values.data() + vdz * 2;
-    float *val0 = values.data() + vdz * 0;
-    float *val1 = values.data() + vdz * 1;
-    //int offm1 = vdz * 2, off0 = vdz * 0, off1 = vdz * 1;
+    auto build_slab = [&](slab &out, int k0, int k1) {
+      int vertex_index = 0;
 
-    // fill first slices of edges and values
-    for (int i = 0; i != dz; ++i) {
-      edge_indices[dz+i] = -1;
-    }
+      // Each cube owns three edges 0->1 0->3 0->4
+      // We need two slices of cube edges to make all the cubes in a slice.
+      std::vector<int> edge_indices(dz*2);
 
-    for (int j = 0; j != ydim; ++j) {
-      for (int i = 0; i != xdim; ++i) {
-        int idx = j * xdim + i;
-        val0[idx] = fn(i, j, 0);
-      }
-    }
+      // We need three slices in values[]
+      std::vector<float> values(vdz * 3);
+      float *valm1 = values.data() + vdz * 2;
+      float *val0 = values.data() + vdz * 0;
+      float *val1 = values.data() + vdz * 1;
 
-    // Build the vertices first. One for each edge that changes sign.
-    for (int k = 0; k != zdim; ++k) {
-      int odd = k & 1, even = 1 - odd;
-      for (int i = 0; i != dz; ++i) {
-        edge_indices[dz*odd+i] = -1;
-      }
+      auto evaluate = [&](float *val, int k) {
+        for (int j = 0; j != ydim; ++j) {
+          fieldRow(fn, xdim, j, k, val + j * xdim, 0);
+        }
+      };
+
+      // Edge index or -1 for the edge v0->v1 (or a reference to the next slab).
+      auto edge = [&](float v0, float v1, int offset, bool ghost, float x, float y, float z, int axis) {
+        if ((v0 < 0) == (v1 < 0)) return -1;
+        float lambda = v0 / (v0 - v1);
+        if (!(lambda >= 0 && lambda <= 1)) return -1;
+        if (ghost) return -2 - offset;
+        (axis == 0 ? x : axis == 1 ? y : z) += lambda;
+        out.vertices.push_back(vertex_generator(x, y, z));
+        return vertex_index++;
+      };
+
+      // Build the vertices of slice k. One for each edge that changes sign.
+      auto build_edges = [&](int k, bool ghost) {
+        int *edges = edge_indices.data() + dz * (k & 1);
+        for (int i = 0; i != dz; ++i) {
+          edges[i] = -1;
+        }
 
-      if (k != zdim-1) {
         for (int j = 0; j != ydim; ++j) {
           for (int i = 0; i != xdim; ++i) {
             int idx = j * xdim + i;
-            val1[idx] = fn(i, j, k+1);
-          }
-        }
-      }
-
-      for (int j = 0; j != ydim; ++j) {
-        for (int i = 0; i != xdim; ++i) {
-          int idx = j * xdim + i;
-          float v0 = val0[idx];
-          float fi = (float)i;
-          float fj = (float)j;
-          float fk = (float)k;
-
-          // x edges
-          if (i != xdim-1) {
-            float v1 = val0[idx + 1];
-            if ((v0 < 0) != (v1 < 0)) {
-              float lambda = v0 / (v0 - v1);
-              if (lambda >= 0 && lambda <= 1) {
-                edge_indices[odd*dz + idx*3+0] = vertex_index++;
-                vertices_.push_back(vertex_generator(fi + lambda, fj, fk));
-              }
+            float v0 = val0[idx];
+            float fi = (float)i;
+            float fj = (float)j;
+            float fk = (float)k;
+
+            // x edges
+            if (i != xdim-1) {
+              edges[idx*3+0] = edge(v0, val0[idx + 1], idx*3+0, ghost, fi, fj, fk, 0);
             }
-          }
 
-          // y edges
-          if (j != ydim-1) {
-            float v1 = val0[idx + xdim];
-            if ((v0 < 0) != (v1 < 0)) {
-              float lambda = v0 / (v0 - v1);
-              if (lambda >= 0 && lambda <= 1) {
-                edge_indices[odd*dz + idx*3+1] = vertex_index++;
-                vertices_.push_back(vertex_generator(fi, fj + lambda, fk));
-              }
+            // y edges
+            if (j != ydim-1) {
+              edges[idx*3+1] = edge(v0, val0[idx + xdim], idx*3+1, ghost, fi, fj, fk, 1);
             }
-          }
 
-          // z edges
-          if (k != zdim-1) {
-            float v1 = val1[idx];
-            if ((v0 < 0) != (v1 < 0)) {
-              float lambda = v0 / (v0 - v1);
-              if (lambda >= 0 && lambda <= 1) {
-                edge_indices[odd*dz + idx*3+2] = vertex_index++;
-                vertices_.push_back(vertex_generator(fi, fj, fk + lambda));
-              }
+            // z edges (the next slab does not need these)
+            if (k != zdim-1 && !ghost) {
+              edges[idx*3+2] = edge(v0, val1[idx], idx*3+2, ghost, fi, fj, fk, 2);
             }
           }
         }
-      }
+      };
 
-      // Build the indices. Use the mc_triangles table to choose triangles depending on sign.
-      if (k != 0) {
+      // Build the indices of the cubes between slices k-1 and k.
+      // Use the mc_triangles table to choose triangles depending on sign.
+      auto build_cubes = [&](int k) {
+        int odd = k & 1, even = 1 - odd;
         int edge_offsets[16] = {
           0 * dx + 0 * dy + even * dz + 0,  // 0,1, (this cube, x component)
           1 * dx + 0 * dy + even * dz + 1,  // 1,2,
@@ -431,22 +1020,73 @@ public:
               int i0 = edge_indices [idx*3 + edge_offsets [t0]];
               int i1 = edge_indices [idx*3 + edge_offsets [t1]];
               int i2 = edge_indices [idx*3 + edge_offsets [t2]];
-              if (i0 >= 0 && i1 >= 0 && i2 >= 0) {
-                indices_.push_back((index_t)i0);
-                indices_.push_back((index_t)i1);
-                indices_.push_back((index_t)i2);
+              if (i0 != -1 && i1 != -1 && i2 != -1) {
+                out.indices.push_back(i0);
+                out.indices.push_back(i1);
+                out.indices.push_back(i2);
               }
             }
           }
         }
+      };
+
+      evaluate(val0, k0);
+      for (int k = k0; k <= k1; ++k) {
+        if (k != k1) {
+          if (k != zdim-1) evaluate(val1, k+1);
+          build_edges(k, false);
+          if (k == k0) {
+            int *edges = edge_indices.data() + dz * (k & 1);
+            out.first_edges.assign(edges, edges + dz);
+          }
+        } else if (k != zdim) {
+          // The first slice of the next slab, which val0 already holds.
+          build_edges(k, true);
+        } else {
+          break;
+        }
+
+        if (k != k0) build_cubes(k);
+
+        // rotate value offsets
+        float *t = val0;
+        val0 = val1;
+        val1 = valm1;
+        valm1 = t;
       }
+    };
 
-      // rotate value offsets
-      float *t = val0;
-      val0 = val1;
-      val1 = valm1;
-      valm1 = t;
+    parallelFor((size_t)numSlabs, numThreads, [&](size_t begin, size_t end) {
+      for (size_t s = begin; s != end; ++s) {
+        build_slab(slabs[s], (int)(zdim * s / numSlabs), (int)(zdim * (s + 1) / numSlabs));
+      }
+    });
+
+    // Join the slabs in order, which gives the same mesh as a single slab.
+    std::vector<size_t> vertex_base(numSlabs + 1), index_base(numSlabs + 1);
+    vertex_base[0] = vertices_.size();
+    index_base[0] = indices_.size();
+    for (int s = 0; s != numSlabs; ++s) {
+      vertex_base[s+1] = vertex_base[s] + slabs[s].vertices.size();
+      index_base[s+1] = index_base[s] + slabs[s].indices.size();
     }
+
+    vertices_.reserve(vertex_base[numSlabs]);
+    for (auto &slab : slabs) {
+      vertices_.insert(vertices_.end(), slab.vertices.begin(), slab.vertices.end());
+      std::vector<vertex_t>().swap(slab.vertices);
+    }
+
+    indices_.resize(index_base[numSlabs]);
+    parallelFor((size_t)numSlabs, numThreads, [&](size_t begin, size_t end) {
+      for (size_t s = begin; s != end; ++s) {
+        index_t *dest = indices_.data() + index_base[s];
+        for (int i : slabs[s].indices) {
+          size_t index = i >= 0 ? vertex_base[s] + i : vertex_base[s+1] + slabs[s+1].first_edges[-2 - i];
+          *dest++ = (index_t)index;
+        }
+      }
+    });
   }
 
   // write the mesh as a CSV file
@@ -499,40 +1139,67 @@ public:
   }
 
 private:
-  struct expandedVertex {
-    vertex_t vtx;
-    size_t order;
-  };
+  // Run fn(begin, end) over ranges of [0, n) on up to numThreads threads.
+  template <class Function>
+  static void parallelFor(size_t n, unsigned numThreads, Function fn) {
+    size_t chunk = (n + numThreads - 1) / std::max(numThreads, 1u);
+    if (numThreads <= 1 || chunk == 0) {
+      fn(0, n);
+      return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t begin = chunk; begin < n; begin += chunk) {
+      threads.emplace_back(fn, begin, std::min(begin + chunk, n));
+    }
+    fn(0, std::min(chunk, n));
+    for (auto &t : threads) t.join();
+  }
 
-  // convert the indexed form to the expanded form.
-  std::vector<expandedVertex> expand() const {
-    std::vector<expandedVertex> result;
-    result.reserve(indices_.size());
-    for (size_t i = 0; i != indices_.size(); ++i) {
-      result.push_back(expandedVertex{vertices_[indices_[i]], i});
+  // One row of field values, from fn(i, j, k, count, values) if it has one.
+  template <class Function>
+  static auto fieldRow(Function &fn, int xdim, int j, int k, float *values, int) -> decltype(fn(0, j, k, xdim, values), void()) {
+    fn(0, j, k, xdim, values);
+  }
+
+  // One row of field values, from fn(i, j, k) at each point.
+  template <class Function>
+  static void fieldRow(Function &fn, int xdim, int j, int k, float *values, long) {
+    for (int i = 0; i != xdim; ++i) {
+      values[i] = (float)fn(i, j, k);
     }
-    return std::move(result);
   }
 
-  // convert the expanded form to the indexed form.
-  void compact(std::vector<expandedVertex> &expanded) {
-    std::sort(
-      expanded.begin(), expanded.end(),
-      [](const expandedVertex &a, const expandedVertex &b) {
-        return memcmp(&a.vtx, &b.vtx, sizeof(a.vtx)) < 0;
-      }
-    );
+  // A power of two at least twice n, for a half full open addressing table.
+  static size_t hashTableSize(size_t n) {
+    size_t size = 16;
+    while (size < n * 2) size *= 2;
+    return size;
+  }
+
+  static uint32_t hashBytes(const void *data, size_t size) {
+    uint32_t h = 0x811c9dc5;
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+      uint32_t w;
+      memcpy(&w, p + i, 4);
+      h = (h ^ w) * 0x01000193;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+  }
 
-    vertices_.resize(0);
-    size_t imax = expanded.size();
-    for (size_t i = 0; i != imax; ) {
-      auto &v0 = expanded[i];
-      size_t idx = vertices_.size();
-      vertices_.emplace_back(expanded[i].vtx);
-      indices_[expanded[i].order] = (index_t)idx;
-      for (++i; i < imax && !memcmp(&v0.vtx, &expanded[i].vtx, sizeof(v0.vtx)); ++i) {
-        indices_[expanded[i].order] = (index_t)idx;
+  // Return the value in the table that equal() matches, inserting value if there is none.
+  template <class Equal>
+  static uint32_t hashInsert(std::vector<uint32_t> &table, uint32_t hash, uint32_t value, Equal equal) {
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+      if (table[i] == ~(uint32_t)0) {
+        table[i] = value;
+        return value;
       }
+      if (equal(table[i])) return table[i];
     }
   }
 
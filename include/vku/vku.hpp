@@ -18,7 +18,9 @@
 #ifndef VKU_HPP
 #define VKU_HPP
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <unordered_map>
@@ -27,6 +29,7 @@
 #include <chrono>
 #include <functional>
 #include <cstddef>
+#include <limits>
 
 #include <vulkan/spirv.hpp11>
 #include <vulkan/vulkan.hpp>
@@ -42,6 +45,136 @@ std::string format(const char *fmt, Args... args) {
   return std::move(result);
 }
 
+/// Host side counts of the costs hidden inside vku.
+/// Define VKU_NO_COUNTERS before including vku.hpp to compile the counting out.
+/// example:
+///     vku::FrameCounters frameCounters;
+///     ...
+///     // Once per frame:
+///     auto &c = frameCounters.update();
+///     std::cout << c.queueSubmits << " submits, " << c.stagingBytes << " bytes staged\n";
+struct Counters {
+  /// Device memory allocations and bytes, in total and for each heap.
+  uint64_t allocations = 0;
+  uint64_t allocatedBytes = 0;
+  std::array<uint64_t, VK_MAX_MEMORY_HEAPS> heapAllocations{};
+  std::array<uint64_t, VK_MAX_MEMORY_HEAPS> heapBytes{};
+
+  /// Bytes copied through staging buffers by upload().
+  uint64_t stagingBytes = 0;
+
+  /// executeImmediately() calls and the time spent waiting for them.
+  uint64_t immediateCalls = 0;
+  uint64_t immediateWaitNs = 0;
+
+  uint64_t barriers = 0;
+  uint64_t descriptorWrites = 0;
+  uint64_t pipelinesCreated = 0;
+  uint64_t queueSubmits = 0;
+
+  Counters operator-(const Counters &rhs) const {
+    Counters r;
+    r.allocations = allocations - rhs.allocations;
+    r.allocatedBytes = allocatedBytes - rhs.allocatedBytes;
+    for (size_t i = 0; i != heapAllocations.size(); ++i) {
+      r.heapAllocations[i] = heapAllocations[i] - rhs.heapAllocations[i];
+      r.heapBytes[i] = heapBytes[i] - rhs.heapBytes[i];
+    }
+    r.stagingBytes = stagingBytes - rhs.stagingBytes;
+    r.immediateCalls = immediateCalls - rhs.immediateCalls;
+    r.immediateWaitNs = immediateWaitNs - rhs.immediateWaitNs;
+    r.barriers = barriers - rhs.barriers;
+    r.descriptorWrites = descriptorWrites - rhs.descriptorWrites;
+    r.pipelinesCreated = pipelinesCreated - rhs.pipelinesCreated;
+    r.queueSubmits = queueSubmits - rhs.queueSubmits;
+    return r;
+  }
+};
+
+namespace detail {
+  // The live counters. Relaxed atomics keep the counting cheap from any thread.
+  struct AtomicCounters {
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> allocatedBytes;
+    std::atomic<uint64_t> heapAllocations[VK_MAX_MEMORY_HEAPS];
+    std::atomic<uint64_t> heapBytes[VK_MAX_MEMORY_HEAPS];
+    std::atomic<uint64_t> stagingBytes;
+    std::atomic<uint64_t> immediateCalls;
+    std::atomic<uint64_t> immediateWaitNs;
+    std::atomic<uint64_t> barriers;
+    std::atomic<uint64_t> descriptorWrites;
+    std::atomic<uint64_t> pipelinesCreated;
+    std::atomic<uint64_t> queueSubmits;
+  };
+
+  // Static storage is zero initialised.
+  inline AtomicCounters &counters() {
+    static AtomicCounters c;
+    return c;
+  }
+} // namespace detail
+
+#ifdef VKU_NO_COUNTERS
+  #define VKU_COUNT(counter, value)
+#else
+  #define VKU_COUNT(counter, value) (vku::detail::counters().counter.fetch_add((uint64_t)(value), std::memory_order_relaxed))
+#endif
+
+/// Return the counts since the program started. These are all zero with VKU_NO_COUNTERS.
+inline Counters counters() {
+  Counters r;
+#ifndef VKU_NO_COUNTERS
+  auto &c = detail::counters();
+  auto get = [](const std::atomic<uint64_t> &a) { return a.load(std::memory_order_relaxed); };
+  r.allocations = get(c.allocations);
+  r.allocatedBytes = get(c.allocatedBytes);
+  for (size_t i = 0; i != r.heapAllocations.size(); ++i) {
+    r.heapAllocations[i] = get(c.heapAllocations[i]);
+    r.heapBytes[i] = get(c.heapBytes[i]);
+  }
+  r.stagingBytes = get(c.stagingBytes);
+  r.immediateCalls = get(c.immediateCalls);
+  r.immediateWaitNs = get(c.immediateWaitNs);
+  r.barriers = get(c.barriers);
+  r.descriptorWrites = get(c.descriptorWrites);
+  r.pipelinesCreated = get(c.pipelinesCreated);
+  r.queueSubmits = get(c.queueSubmits);
+#endif
+  return r;
+}
+
+/// Counts per frame: call update() once a frame to get the change since the last call.
+class FrameCounters {
+public:
+  FrameCounters() : last_(counters()) {
+  }
+
+  const Counters &update() {
+    Counters now = counters();
+    delta_ = now - last_;
+    last_ = now;
+    return delta_;
+  }
+
+  /// Return the result of the last update().
+  const Counters &delta() const { return delta_; }
+
+private:
+  Counters last_;
+  Counters delta_;
+};
+
+/// Device level function pointers from vkGetDeviceProcAddr.
+/// vulkan.hpp calls use the loader's exported functions by default, and each of those jumps
+/// through a trampoline to find the device's function. Passing a DeviceDispatch as the last
+/// argument calls the driver directly, which helps commands recorded many times a frame.
+/// vku calls that record commands in loops take one too.
+/// example:
+///     vku::DeviceDispatch dispatch{instance, device};
+///     cb.drawIndexed(indexCount, 1, 0, 0, 0, dispatch);
+///     pool.recordBatch(cb, dispatch);
+typedef vk::DispatchLoaderDynamic DeviceDispatch;
+
 /// Utility function for finding memory types for uniforms and images.
 inline int findMemoryTypeIndex(const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t memoryTypeBits, vk::MemoryPropertyFlags search) {
   for (int i = 0; i != memprops.memoryTypeCount; ++i, memoryTypeBits >>= 1) {
@@ -54,6 +187,21 @@ inline int findMemoryTypeIndex(const vk::PhysicalDeviceMemoryProperties &memprop
   return -1;
 }
 
+/// Count an allocation of a memory type.
+inline void countAllocation(const vk::PhysicalDeviceMemoryProperties &memprops, int memoryTypeIndex, vk::DeviceSize size) {
+#ifndef VKU_NO_COUNTERS
+  VKU_COUNT(allocations, 1);
+  VKU_COUNT(allocatedBytes, size);
+  if (memoryTypeIndex >= 0 && (uint32_t)memoryTypeIndex < memprops.memoryTypeCount) {
+    uint32_t heap = memprops.memoryTypes[memoryTypeIndex].heapIndex;
+    VKU_COUNT(heapAllocations[heap], 1);
+    VKU_COUNT(heapBytes[heap], size);
+  }
+#else
+  (void)memprops; (void)memoryTypeIndex; (void)size;
+#endif
+}
+
 /// Execute commands immediately and wait for the device to finish.
 inline void executeImmediately(vk::Device device, vk::CommandPool commandPool, vk::Queue queue, const std::function<void (vk::CommandBuffer cb)> &func) {
   vk::CommandBufferAllocateInfo cbai{ commandPool, vk::CommandBufferLevel::ePrimary, 1 };
@@ -63,15 +211,53 @@ inline void executeImmediately(vk::Device device, vk::CommandPool commandPool, v
   func(cbs[0]);
   cbs[0].end();
 
+  // Wait for this submission only, not for everything else on the device.
+  auto fence = device.createFenceUnique(vk::FenceCreateInfo{});
   vk::SubmitInfo submit;
   submit.commandBufferCount = (uint32_t)cbs.size();
   submit.pCommandBuffers = cbs.data();
-  queue.submit(submit, vk::Fence{});
-  device.waitIdle();
+  queue.submit(submit, *fence);
+#ifndef VKU_NO_COUNTERS
+  auto start = std::chrono::high_resolution_clock::now();
+#endif
+  device.waitForFences(*fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+#ifndef VKU_NO_COUNTERS
+  VKU_COUNT(immediateCalls, 1);
+  VKU_COUNT(queueSubmits, 1);
+  VKU_COUNT(immediateWaitNs, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count());
+#endif
 
   device.freeCommandBuffers(commandPool, cbs);
 }
 
+/// Submit a command buffer to a queue, waiting on and signalling semaphores.
+/// Use this to hand work between queues, eg. compute results consumed by graphics:
+///     vku::submit(computeQueue, computeCb, {}, {}, {computeDone});
+///     vku::submit(graphicsQueue, drawCb, {computeDone}, {vk::PipelineStageFlagBits::eDrawIndirect}, {}, fence);
+inline void submit(vk::Queue queue, vk::CommandBuffer cb, const std::vector<vk::Semaphore> &waitSemaphores = {}, const std::vector<vk::PipelineStageFlags> &waitStages = {}, const std::vector<vk::Semaphore> &signalSemaphores = {}, vk::Fence fence = vk::Fence{}) {
+  vk::SubmitInfo submit;
+  submit.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+  submit.pWaitSemaphores = waitSemaphores.data();
+  submit.pWaitDstStageMask = waitStages.data();
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &cb;
+  submit.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
+  submit.pSignalSemaphores = signalSemaphores.data();
+  queue.submit(submit, fence);
+  VKU_COUNT(queueSubmits, 1);
+}
+
+/// Create one semaphore for each frame in flight.
+/// A binary semaphore must be waited on before it is signalled again,
+/// so cross queue signals need one per frame.
+inline std::vector<vk::UniqueSemaphore> createSemaphores(vk::Device device, int count) {
+  std::vector<vk::UniqueSemaphore> result;
+  for (int i = 0; i != count; ++i) {
+    result.push_back(device.createSemaphoreUnique(vk::SemaphoreCreateInfo{}));
+  }
+  return std::move(result);
+}
+
 /// Scale a value by mip level, but do not reduce to zero.
 inline uint32_t mipScale(uint32_t value, uint32_t mipLevel) {
   return std::max(value >> mipLevel, (uint32_t)1);
@@ -460,6 +646,15 @@ public:
 
     // Storage class of the variable, eg. spv::StorageClass::Uniform
     spv::StorageClass storageClass;
+
+    // True for uniforms, buffers, images and samplers bound through descriptor sets.
+    bool isDescriptor;
+
+    // The descriptor type if isDescriptor is true, eg. vk::DescriptorType::eStorageBuffer
+    vk::DescriptorType descriptorType;
+
+    // The array size of the descriptor. Zero for runtime sized arrays.
+    uint32_t descriptorCount;
   };
 
   /// Get a list of variables from the shader.
@@ -472,6 +667,9 @@ public:
     std::unordered_map<int, int> bindings;
     std::unordered_map<int, int> locations;
     std::unordered_map<int, int> sets;
+    std::unordered_map<int, int> blocks;
+    std::unordered_map<int, int> types;
+    std::unordered_map<int, uint32_t> constants;
     std::unordered_map<int, std::string> debugNames;
 
     for (int i = 5; i != s.opcodes_.size(); i += s.opcodes_[i] >> 16) {
@@ -485,10 +683,16 @@ public:
           locations[name] = s.opcodes_[i + 3];
         } else if (decoration == spv::Decoration::DescriptorSet) {
           sets[name] = s.opcodes_[i + 3];
+        } else if (decoration == spv::Decoration::Block || decoration == spv::Decoration::BufferBlock) {
+          blocks[name] = (int)decoration;
         }
       } else if (op == spv::Op::OpName) {
         int name = s.opcodes_[i + 1];
         debugNames[name] = (const char *)&s.opcodes_[i + 2];
+      } else if (op >= spv::Op::OpTypeVoid && op <= spv::Op::OpTypeForwardPointer) {
+        types[s.opcodes_[i + 1]] = i;
+      } else if (op == spv::Op::OpConstant) {
+        constants[s.opcodes_[i + 2]] = s.opcodes_[i + 3];
       }
     }
 
@@ -496,22 +700,46 @@ public:
     for (int i = 5; i != s.opcodes_.size(); i += s.opcodes_[i] >> 16) {
       spv::Op op = spv::Op(s.opcodes_[i] & 0xffff);
       if (op == spv::Op::OpVariable) {
-        int name = s.opcodes_[i + 1];
+        // OpVariable <pointer type> <result> <storage class>
+        int type = s.opcodes_[i + 1];
+        int name = s.opcodes_[i + 2];
         auto sc = spv::StorageClass(s.opcodes_[i + 3]);
         Variable b;
         b.debugName = debugNames[name];
         b.name = name;
         b.location = locations[name];
+        b.binding = bindings[name];
         b.set = sets[name];
         b.instruction = i;
         b.storageClass = sc;
+        b.isDescriptor = false;
+        b.descriptorType = vk::DescriptorType::eUniformBuffer;
+        b.descriptorCount = 1;
+        if (sc == spv::StorageClass::Uniform || sc == spv::StorageClass::UniformConstant || sc == spv::StorageClass::StorageBuffer) {
+          reflectDescriptor(b, types, constants, blocks, type);
+        }
         result.push_back(b);
       }
     }
     return std::move(result);
   }
 
+  /// Get the workgroup size of a compute shader (OpExecutionMode LocalSize).
+  std::array<uint32_t, 3> localSize() const {
+    std::array<uint32_t, 3> result{{1, 1, 1}};
+    for (int i = 5; i != s.opcodes_.size(); i += s.opcodes_[i] >> 16) {
+      spv::Op op = spv::Op(s.opcodes_[i] & 0xffff);
+      if (op == spv::Op::OpExecutionMode && spv::ExecutionMode(s.opcodes_[i + 2]) == spv::ExecutionMode::LocalSize) {
+        result = {{s.opcodes_[i + 3], s.opcodes_[i + 4], s.opcodes_[i + 5]}};
+      }
+    }
+    return result;
+  }
+
   bool ok() const { return s.ok_; }
+
+  /// Get the SPIR-V words of the shader.
+  const std::vector<uint32_t> &opcodes() const { return s.opcodes_; }
   VkShaderModule module() { return *s.module_; }
 
   /// Write a C++ consumable dump of the shader.
@@ -538,6 +766,43 @@ public:
   }
 
 private:
+  // Follow a variable's pointer type to find its descriptor type and array size.
+  void reflectDescriptor(Variable &b, std::unordered_map<int, int> &types, std::unordered_map<int, uint32_t> &constants, std::unordered_map<int, int> &blocks, int type) const {
+    typedef vk::DescriptorType dt;
+    auto sc = b.storageClass;
+    for (int depth = 0; depth != 8 && types.count(type); ++depth) {
+      const uint32_t *inst = s.opcodes_.data() + types[type];
+      switch (spv::Op(inst[0] & 0xffff)) {
+        case spv::Op::OpTypePointer: type = inst[3]; break;
+        case spv::Op::OpTypeArray: b.descriptorCount *= constants[inst[3]]; type = inst[2]; break;
+        case spv::Op::OpTypeRuntimeArray: b.descriptorCount = 0; type = inst[2]; break;
+        case spv::Op::OpTypeStruct: {
+          b.isDescriptor = sc != spv::StorageClass::UniformConstant;
+          bool storage = sc == spv::StorageClass::StorageBuffer || blocks[type] == (int)spv::Decoration::BufferBlock;
+          b.descriptorType = storage ? dt::eStorageBuffer : dt::eUniformBuffer;
+          return;
+        }
+        case spv::Op::OpTypeImage: {
+          // OpTypeImage <result> <sampled type> <dim> <depth> <arrayed> <ms> <sampled> <format>
+          auto dim = spv::Dim(inst[3]);
+          bool storage = inst[7] == 2;
+          b.isDescriptor = true;
+          if (dim == spv::Dim::Buffer) {
+            b.descriptorType = storage ? dt::eStorageTexelBuffer : dt::eUniformTexelBuffer;
+          } else if (dim == spv::Dim::SubpassData) {
+            b.descriptorType = dt::eInputAttachment;
+          } else {
+            b.descriptorType = storage ? dt::eStorageImage : dt::eSampledImage;
+          }
+          return;
+        }
+        case spv::Op::OpTypeSampledImage: b.isDescriptor = true; b.descriptorType = dt::eCombinedImageSampler; return;
+        case spv::Op::OpTypeSampler: b.isDescriptor = true; b.descriptorType = dt::eSampler; return;
+        default: return;
+      }
+    }
+  }
+
   struct State {
     std::vector<uint32_t> opcodes_;
     vk::UniqueShaderModule module_;
@@ -654,6 +919,7 @@ public:
     pipelineInfo.pDynamicState = dynamicState_.empty() ? nullptr : &dynState;
     pipelineInfo.subpass = subpass_;
 
+    VKU_COUNT(pipelinesCreated, 1);
     return device.createGraphicsPipelineUnique(pipelineCache, pipelineInfo);
   }
 
@@ -842,19 +1108,39 @@ public:
   /// Set the compute shader module.
   ComputePipelineMaker &module(const vk::PipelineShaderStageCreateInfo &value) {
     stage_ = value;
+    return *this;
+  }
+
+  /// Set a 32 bit specialization constant, eg. a workgroup size declared with
+  /// layout(constant_id = 0) const uint WG = 256; layout(local_size_x_id = 0) in;
+  ComputePipelineMaker &specializationConstant(uint32_t constantID, uint32_t value) {
+    specializationEntries_.emplace_back(constantID, (uint32_t)(specializationData_.size() * sizeof(uint32_t)), sizeof(uint32_t));
+    specializationData_.push_back(value);
+    return *this;
   }
 
   /// Create a managed handle to a compute shader.
   vk::UniquePipeline createUnique(vk::Device device, const vk::PipelineCache &pipelineCache, const vk::PipelineLayout &pipelineLayout) {
     vk::ComputePipelineCreateInfo pipelineInfo{};
 
+    vk::SpecializationInfo specializationInfo{
+      (uint32_t)specializationEntries_.size(), specializationEntries_.data(),
+      specializationData_.size() * sizeof(uint32_t), specializationData_.data()
+    };
+
     pipelineInfo.stage = stage_;
+    if (!specializationEntries_.empty()) {
+      pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+    }
     pipelineInfo.layout = pipelineLayout;
 
+    VKU_COUNT(pipelinesCreated, 1);
     return device.createComputePipelineUnique(pipelineCache, pipelineInfo);
   }
 private:
   vk::PipelineShaderStageCreateInfo stage_;
+  std::vector<vk::SpecializationMapEntry> specializationEntries_;
+  std::vector<uint32_t> specializationData_;
 };
 
 /// A generic buffer that may be used as a vertex buffer, uniform buffer or other kinds of memory resident data.
@@ -880,6 +1166,7 @@ public:
     mai.allocationSize = memreq.size;
     mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, memflags);
     mem_ = device.allocateMemoryUnique(mai);
+    countAllocation(memprops, (int)mai.memoryTypeIndex, mai.allocationSize);
 
     device.bindBufferMemory(*buffer_, *mem_, 0);
   }
@@ -894,15 +1181,17 @@ public:
 
   /// For a device local buffer, copy memory to the buffer object immediately.
   /// Note that this will stall the pipeline!
-  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const void *value, vk::DeviceSize size) const {
+  /// offset is where in this buffer to put the data.
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const void *value, vk::DeviceSize size, vk::DeviceSize offset = 0) const {
     if (size == 0) return;
     using buf = vk::BufferUsageFlagBits;
     using pfb = vk::MemoryPropertyFlagBits;
     auto tmp = vku::GenericBuffer(device, memprops, buf::eTransferSrc, size, pfb::eHostVisible);
     tmp.updateLocal(device, value, size);
+    VKU_COUNT(stagingBytes, size);
 
     vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
-      vk::BufferCopy bc{0, 0, size};
+      vk::BufferCopy bc{0, offset, size};
       cb.copyBuffer(tmp.buffer(), *buffer_, bc);
     });
   }
@@ -920,6 +1209,7 @@ public:
   void barrier(vk::CommandBuffer cb, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask, vk::DependencyFlags dependencyFlags, vk::AccessFlags srcAccessMask, vk::AccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) const {
     vk::BufferMemoryBarrier bmb{srcAccessMask, dstAccessMask, srcQueueFamilyIndex, dstQueueFamilyIndex, *buffer_, 0, size_};
     cb.pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, bmb, nullptr);
+    VKU_COUNT(barriers, 1);
   }
 
   template<class Type, class Allocator>
@@ -1011,7 +1301,300 @@ public:
   }
 };
 
+/// A host visible buffer of per-draw structures for eUniformBufferDynamic or eStorageBufferDynamic bindings.
+/// Each structure is padded to minUniformBufferOffsetAlignment (or minStorageBufferOffsetAlignment)
+/// so that one descriptor set can address every draw through a dynamic offset.
+/// example:
+///     vku::DynamicUniformBuffer perDraw(device, memprops, sizeof(DrawUniform), 4096, props.limits.minUniformBufferOffsetAlignment);
+///     update.beginBuffers(0, 0, vk::DescriptorType::eUniformBufferDynamic);
+///     update.dynamicBuffer(perDraw);
+///     ...
+///     perDraw.reset();
+///     for (auto &obj : objects) {
+///       uint32_t offset = perDraw.push(obj.uniform);
+///       cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, set, offset);
+///       cb.drawIndexed(...);
+///     }
+///     perDraw.flush(device);
+///
+/// Use one of these for each frame in flight as the GPU reads the memory directly.
+class DynamicUniformBuffer : public GenericBuffer {
+public:
+  DynamicUniformBuffer() {
+  }
+
+  /// Make a buffer holding up to maxElements structures of elementSize bytes.
+  DynamicUniformBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::DeviceSize elementSize, uint32_t maxElements, vk::DeviceSize minOffsetAlignment, vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eUniformBuffer) :
+    GenericBuffer(device, memprops, usage, alignedSize(elementSize, minOffsetAlignment) * maxElements, vk::MemoryPropertyFlagBits::eHostVisible) {
+    elementSize_ = elementSize;
+    stride_ = alignedSize(elementSize, minOffsetAlignment);
+    maxElements_ = maxElements;
+
+    // Stay mapped for the life of the buffer.
+    ptr_ = (uint8_t*)map(device);
+  }
+
+  /// Copy one structure into the next slot and return its dynamic offset.
+  uint32_t push(const void *value, vk::DeviceSize size) {
+    if (numElements_ == maxElements_ || size > elementSize_) {
+      vk::throwResultException(vk::Result::eErrorOutOfDeviceMemory, "vku::DynamicUniformBuffer::push");
+    }
+    uint32_t offset = (uint32_t)(stride_ * numElements_++);
+    memcpy(ptr_ + offset, value, (size_t)size);
+    return offset;
+  }
+
+  template<class Type>
+  uint32_t push(const Type &value) {
+    return push(&value, sizeof(Type));
+  }
+
+  /// Pack a vector of structures and return the dynamic offset of each one.
+  template<class Type, class Allocator>
+  std::vector<uint32_t> pack(const std::vector<Type, Allocator> &values) {
+    std::vector<uint32_t> offsets;
+    offsets.reserve(values.size());
+    for (auto &v : values) {
+      offsets.push_back(push(v));
+    }
+    return std::move(offsets);
+  }
+
+  /// Start again at the beginning, typically once per frame after the frame's fence.
+  void reset() { numElements_ = 0; }
+
+  /// Return the range to give the descriptor, the size of one structure.
+  vk::DeviceSize range() const { return elementSize_; }
+
+  /// Return the distance between structures in bytes.
+  vk::DeviceSize stride() const { return stride_; }
+
+  /// Return the number of structures pushed since the last reset().
+  uint32_t numElements() const { return numElements_; }
+
+  /// Round size up to a multiple of alignment (a power of two or zero).
+  static vk::DeviceSize alignedSize(vk::DeviceSize size, vk::DeviceSize alignment) {
+    return alignment ? (size + alignment - 1) & ~(alignment - 1) : size;
+  }
+
+private:
+  uint8_t *ptr_ = nullptr;
+  vk::DeviceSize elementSize_ = 0;
+  vk::DeviceSize stride_ = 0;
+  uint32_t maxElements_ = 0;
+  uint32_t numElements_ = 0;
+};
+
+/// Many meshes suballocated from one vertex buffer and one 32 bit index buffer.
+/// Every mesh is drawn from the same bound buffers using its firstIndex and vertexOffset,
+/// and draws queued between pipeline changes are issued as one drawIndexedIndirect.
+/// example:
+///     vku::GeometryPool pool(device, memprops, sizeof(Vertex), 1000000, 3000000);
+///     uint32_t cube = pool.add(device, memprops, commandPool, queue, cubeVertices, cubeIndices);
+///     ...
+///     pool.beginFrame(frameIndex);
+///     pool.bind(cb);
+///     cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *solidPipeline);
+///     for (auto &obj : solidObjects) pool.draw(obj.mesh, 1, obj.instance);
+///     pool.recordBatch(cb);
+///     cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *glassPipeline);
+///     ...
+///
+/// Instance data is found with gl_InstanceIndex, so firstInstance needs the drawIndirectFirstInstance
+/// feature. Without multiDrawIndirect each command is issued with its own drawIndexedIndirect.
+/// The Mesh structure has the same layout as vku::CullMesh for GPU culling.
+class GeometryPool {
+public:
+  /// Where a mesh lives in the shared buffers.
+  struct Mesh {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t vertexCount;
+  };
+
+  GeometryPool() {
+  }
+
+  /// Make room for maxVertices of vertexStride bytes, maxIndices indices and maxDraws draws per frame.
+  GeometryPool(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t vertexStride, uint32_t maxVertices, uint32_t maxIndices, uint32_t maxDraws = 4096, int framesInFlight = 2, bool multiDrawIndirect = true) {
+    typedef vk::BufferUsageFlagBits buf;
+    vertexStride_ = vertexStride;
+    maxDraws_ = maxDraws;
+    multiDrawIndirect_ = multiDrawIndirect;
+    vertices_ = GenericBuffer(device, memprops, buf::eVertexBuffer|buf::eStorageBuffer|buf::eTransferDst, (vk::DeviceSize)vertexStride * std::max(maxVertices, 1u));
+    indices_ = GenericBuffer(device, memprops, buf::eIndexBuffer|buf::eStorageBuffer|buf::eTransferDst, sizeof(uint32_t) * (vk::DeviceSize)std::max(maxIndices, 1u));
+    freeVertices_.release(0, maxVertices);
+    freeIndices_.release(0, maxIndices);
+
+    // The commands are written by the CPU and read once by the GPU, so stay in host memory.
+    for (int i = 0; i != framesInFlight; ++i) {
+      commands_.emplace_back(device, memprops, buf::eIndirectBuffer, sizeof(vk::DrawIndexedIndirectCommand) * (vk::DeviceSize)std::max(maxDraws, 1u), vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+      mapped_.push_back((vk::DrawIndexedIndirectCommand*)commands_.back().map(device));
+    }
+  }
+
+  /// Copy a mesh into the pool and return its index. sizeof(Vertex) must be the vertex stride.
+  /// Throws if there is not enough room left.
+  template<class Vertex, class Allocator>
+  uint32_t add(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<Vertex, Allocator> &vertices, const std::vector<uint32_t> &indices) {
+    if (sizeof(Vertex) != vertexStride_) {
+      vk::throwResultException(vk::Result::eErrorFormatNotSupported, "vku::GeometryPool::add");
+    }
+    return add(device, memprops, commandPool, queue, vertices.data(), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size());
+  }
+
+  /// Copy numVertices vertices of the pool's stride and numIndices indices into the pool.
+  uint32_t add(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const void *vertices, uint32_t numVertices, const uint32_t *indices, uint32_t numIndices) {
+    uint32_t vertexOffset = freeVertices_.allocate(numVertices);
+    uint32_t firstIndex = freeIndices_.allocate(numIndices);
+    if (vertexOffset == badOffset || firstIndex == badOffset) {
+      if (vertexOffset != badOffset) freeVertices_.release(vertexOffset, numVertices);
+      if (firstIndex != badOffset) freeIndices_.release(firstIndex, numIndices);
+      vk::throwResultException(vk::Result::eErrorOutOfDeviceMemory, "vku::GeometryPool::add");
+    }
+
+    vertices_.upload(device, memprops, commandPool, queue, vertices, (vk::DeviceSize)numVertices * vertexStride_, (vk::DeviceSize)vertexOffset * vertexStride_);
+    indices_.upload(device, memprops, commandPool, queue, indices, numIndices * sizeof(uint32_t), firstIndex * sizeof(uint32_t));
+
+    Mesh mesh{numIndices, firstIndex, (int32_t)vertexOffset, numVertices};
+    if (freeMeshes_.empty()) {
+      meshes_.push_back(mesh);
+      return (uint32_t)meshes_.size() - 1;
+    }
+    uint32_t id = freeMeshes_.back();
+    freeMeshes_.pop_back();
+    meshes_[id] = mesh;
+    return id;
+  }
+
+  /// Free a mesh's space for reuse. Only do this when the GPU has finished drawing it.
+  void remove(uint32_t mesh) {
+    Mesh &m = meshes_[mesh];
+    freeVertices_.release((uint32_t)m.vertexOffset, m.vertexCount);
+    freeIndices_.release(m.firstIndex, m.indexCount);
+    m = Mesh{};
+    freeMeshes_.push_back(mesh);
+  }
+
+  /// Start queuing draws for a frame, once the frame's fence has been waited on.
+  void beginFrame(int frameIndex) {
+    frame_ = frameIndex;
+    numDraws_ = 0;
+    batchStart_ = 0;
+    numBatches_ = 0;
+  }
+
+  /// Bind the shared vertex and index buffers. Once per command buffer is enough.
+  template <class Dispatch = vk::DispatchLoaderStatic>
+  void bind(vk::CommandBuffer cb, uint32_t vertexBinding = 0, const Dispatch &d = Dispatch()) const {
+    cb.bindVertexBuffers(vertexBinding, vertices_.buffer(), vk::DeviceSize(0), d);
+    cb.bindIndexBuffer(indices_.buffer(), vk::DeviceSize(0), vk::IndexType::eUint32, d);
+  }
+
+  /// Queue a draw of a mesh for the next recordBatch(). Throws if maxDraws is reached.
+  void draw(uint32_t mesh, uint32_t instanceCount = 1, uint32_t firstInstance = 0) {
+    if (numDraws_ == maxDraws_) {
+      vk::throwResultException(vk::Result::eErrorOutOfHostMemory, "vku::GeometryPool::draw");
+    }
+    const Mesh &m = meshes_[mesh];
+    mapped_[frame_][numDraws_++] = vk::DrawIndexedIndirectCommand{m.indexCount, instanceCount, m.firstIndex, m.vertexOffset, firstInstance};
+  }
+
+  /// Record the draws queued since the last batch with the currently bound pipeline.
+  template <class Dispatch = vk::DispatchLoaderStatic>
+  void recordBatch(vk::CommandBuffer cb, const Dispatch &d = Dispatch()) {
+    uint32_t count = numDraws_ - batchStart_;
+    if (count == 0) return;
+    uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    vk::Buffer buffer = commands_[frame_].buffer();
+    if (multiDrawIndirect_) {
+      cb.drawIndexedIndirect(buffer, (vk::DeviceSize)batchStart_ * stride, count, stride, d);
+    } else {
+      for (uint32_t i = batchStart_; i != numDraws_; ++i) {
+        cb.drawIndexedIndirect(buffer, (vk::DeviceSize)i * stride, 1, stride, d);
+      }
+    }
+    batchStart_ = numDraws_;
+    ++numBatches_;
+  }
+
+  const Mesh &mesh(uint32_t mesh) const { return meshes_[mesh]; }
+
+  /// Return all mesh slots, including removed ones which have zero counts.
+  const std::vector<Mesh> &meshes() const { return meshes_; }
+
+  const GenericBuffer &vertexBuffer() const { return vertices_; }
+  const GenericBuffer &indexBuffer() const { return indices_; }
+  uint32_t vertexStride() const { return vertexStride_; }
+
+  /// Return the number of draws and batches recorded this frame.
+  uint32_t numDraws() const { return numDraws_; }
+  uint32_t numBatches() const { return numBatches_; }
+
+private:
+  static const uint32_t badOffset = ~0u;
+
+  // First fit allocator of ranges, sorted by offset.
+  class Ranges {
+  public:
+    uint32_t allocate(uint32_t size) {
+      if (size == 0) return 0;
+      for (size_t i = 0; i != free_.size(); ++i) {
+        auto &r = free_[i];
+        if (r.second >= size) {
+          uint32_t offset = r.first;
+          r.first += size;
+          r.second -= size;
+          if (r.second == 0) free_.erase(free_.begin() + i);
+          return offset;
+        }
+      }
+      return badOffset;
+    }
+
+    void release(uint32_t offset, uint32_t size) {
+      if (size == 0) return;
+      auto i = std::lower_bound(free_.begin(), free_.end(), std::make_pair(offset, size));
+      i = free_.insert(i, std::make_pair(offset, size));
+      auto next = i + 1;
+      if (next != free_.end() && i->first + i->second == next->first) {
+        i->second += next->second;
+        free_.erase(next);
+      }
+      if (i != free_.begin()) {
+        auto prev = i - 1;
+        if (prev->first + prev->second == i->first) {
+          prev->second += i->second;
+          free_.erase(i);
+        }
+      }
+    }
+
+  private:
+    std::vector<std::pair<uint32_t, uint32_t> > free_;
+  };
+
+  GenericBuffer vertices_;
+  GenericBuffer indices_;
+  std::vector<GenericBuffer> commands_;
+  std::vector<vk::DrawIndexedIndirectCommand*> mapped_;
+  std::vector<Mesh> meshes_;
+  std::vector<uint32_t> freeMeshes_;
+  Ranges freeVertices_;
+  Ranges freeIndices_;
+  uint32_t vertexStride_ = 0;
+  uint32_t maxDraws_ = 0;
+  uint32_t numDraws_ = 0;
+  uint32_t batchStart_ = 0;
+  uint32_t numBatches_ = 0;
+  int frame_ = 0;
+  bool multiDrawIndirect_ = true;
+};
+
 /// Convenience class for updating descriptor sets (uniforms)
+/// For updates every frame, keep one updater and call clear() between uses
+/// or build a template with DescriptorUpdateTemplateMaker.
 class DescriptorSetUpdater {
 public:
   DescriptorSetUpdater(int maxBuffers = 10, int maxImages = 10, int maxBufferViews = 0) {
@@ -1070,6 +1653,12 @@ public:
     }
   }
 
+  /// Call this to add a dynamic buffer after beginBuffers with eUniformBufferDynamic or eStorageBufferDynamic.
+  /// The descriptor covers one structure and the offset of each draw is passed to bindDescriptorSets.
+  void dynamicBuffer(const DynamicUniformBuffer &buffer) {
+    this->buffer(buffer.buffer(), 0, buffer.range());
+  }
+
   /// Call this to start adding buffer views. (for example, writable images).
   void beginBufferViews(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
     vk::WriteDescriptorSet wdesc{};
@@ -1084,7 +1673,7 @@ public:
 
   /// Call this to add a buffer view. (Texel images)
   void bufferView(vk::BufferView view) {
-    if (!descriptorWrites_.empty() && numBufferViews_ != bufferViews_.size() && descriptorWrites_.back().pImageInfo) {
+    if (!descriptorWrites_.empty() && numBufferViews_ != bufferViews_.size() && descriptorWrites_.back().pTexelBufferView) {
       descriptorWrites_.back().descriptorCount++;
       bufferViews_[numBufferViews_++] = view;
     } else {
@@ -1100,10 +1689,24 @@ public:
   /// Call this to update the descriptor sets with their pointers (but not data).
   void update(const vk::Device &device) const {
     device.updateDescriptorSets( descriptorWrites_, descriptorCopies_ );
+    VKU_COUNT(descriptorWrites, descriptorWrites_.size());
+  }
+
+  /// Forget the writes and copies so that the updater can be reused without reallocating.
+  void clear() {
+    descriptorWrites_.clear();
+    descriptorCopies_.clear();
+    numBuffers_ = 0;
+    numImages_ = 0;
+    numBufferViews_ = 0;
+    ok_ = true;
   }
 
   /// Returns true if the updater is error free.
   bool ok() const { return ok_; }
+
+  /// Return the writes added so far, eg. for vkCmdPushDescriptorSetKHR.
+  const std::vector<vk::WriteDescriptorSet> &writes() const { return descriptorWrites_; }
 private:
   std::vector<vk::DescriptorBufferInfo> bufferInfo_;
   std::vector<vk::DescriptorImageInfo> imageInfo_;
@@ -1127,6 +1730,13 @@ public:
     s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
   }
 
+  /// Add a dynamic uniform (or storage) buffer binding whose offset is given at bind time.
+  /// See DynamicUniformBuffer.
+  void dynamicBuffer(uint32_t binding, vk::ShaderStageFlags stageFlags, bool storage = false) {
+    auto descriptorType = storage ? vk::DescriptorType::eStorageBufferDynamic : vk::DescriptorType::eUniformBufferDynamic;
+    s.bindings.emplace_back(binding, descriptorType, 1, stageFlags, nullptr);
+  }
+
   void image(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
     s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
   }
@@ -1141,24 +1751,160 @@ public:
     s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
   }
 
+  /// Set the layout flags, eg. eUpdateAfterBindPoolEXT.
+  void flags(vk::DescriptorSetLayoutCreateFlags value) {
+    s.flags = value;
+  }
+
+  /// Set VK_EXT_descriptor_indexing flags for the most recently added binding.
+  /// Does nothing if no binding has been added yet.
+  /// eg. ePartiallyBound|eUpdateAfterBind for large bindless arrays.
+  void bindingFlags(vk::DescriptorBindingFlagsEXT value) {
+    if (s.bindings.empty()) return;
+    s.bindingFlags.resize(s.bindings.size());
+    s.bindingFlags.back() = value;
+  }
+
   /// Create a self-deleting descriptor set object.
   vk::UniqueDescriptorSetLayout createUnique(vk::Device device) const {
     vk::DescriptorSetLayoutCreateInfo dsci{};
+    dsci.flags = s.flags;
     dsci.bindingCount = (uint32_t)s.bindings.size();
     dsci.pBindings = s.bindings.data();
+
+    // Only chain the binding flags if some were set, so plain layouts need no extension.
+    std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags = s.bindingFlags;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT dslbfci{};
+    if (!bindingFlags.empty()) {
+      bindingFlags.resize(s.bindings.size());
+      dslbfci.bindingCount = (uint32_t)bindingFlags.size();
+      dslbfci.pBindingFlags = bindingFlags.data();
+      dsci.pNext = &dslbfci;
+    }
     return device.createDescriptorSetLayoutUnique(dsci);
   }
 
+  /// Return the bindings in the order they were added.
+  const std::vector<vk::DescriptorSetLayoutBinding> &bindings() const { return s.bindings; }
+
 private:
   struct State {
     std::vector<vk::DescriptorSetLayoutBinding> bindings;
     std::vector<std::vector<vk::Sampler> > samplers;
+    std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags;
+    vk::DescriptorSetLayoutCreateFlags flags;
     int numSamplers = 0;
   };
 
   State s;
 };
 
+/// A factory class for descriptor update templates.
+/// A template compiles the shape of a descriptor set update once so that sets
+/// can then be written from a packed structure with a single call and no allocation.
+/// example:
+///     struct Descriptors {
+///       vk::DescriptorBufferInfo ubo;
+///       vk::DescriptorImageInfo texture;
+///     };
+///
+///     vku::DescriptorUpdateTemplateMaker dutm{dslm}; // entries for each binding in order.
+///     auto tmpl = dutm.createUnique(device, *layout);
+///
+///     Descriptors d{{ubo.buffer(), 0, sizeof(Uniform)}, {*sampler, texture.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal}};
+///     vku::updateDescriptorSet(device, set, *tmpl, d);
+///
+/// Descriptor update templates are part of Vulkan 1.1.
+class DescriptorUpdateTemplateMaker {
+public:
+  DescriptorUpdateTemplateMaker() {
+  }
+
+  /// Add an entry for every binding in a layout, packed in the order the bindings were added.
+  /// Buffers take a vk::DescriptorBufferInfo, images and samplers a vk::DescriptorImageInfo
+  /// and texel buffers a vk::BufferView.
+  DescriptorUpdateTemplateMaker(const DescriptorSetLayoutMaker &dslm) {
+    for (auto &b : dslm.bindings()) {
+      binding(b.binding, b.descriptorType, b.descriptorCount);
+    }
+  }
+
+  /// Add an entry at an explicit offset and stride in the update structure.
+  void entry(uint32_t dstBinding, uint32_t dstArrayElement, uint32_t descriptorCount, vk::DescriptorType descriptorType, size_t offset, size_t stride) {
+    s.entries.emplace_back(dstBinding, dstArrayElement, descriptorCount, descriptorType, offset, stride);
+    s.size = std::max(s.size, offset + stride * descriptorCount);
+  }
+
+  /// Add an entry for descriptorCount descriptors packed after the previous entry.
+  /// The offset is aligned as a C++ compiler would place the next member of a struct.
+  void binding(uint32_t dstBinding, vk::DescriptorType descriptorType, uint32_t descriptorCount = 1) {
+    size_t stride = infoSize(descriptorType);
+    size_t alignment = infoAlignment(descriptorType);
+    size_t offset = (s.size + alignment - 1) / alignment * alignment;
+    entry(dstBinding, 0, descriptorCount, descriptorType, offset, stride);
+  }
+
+  /// Return the size in bytes of the structure the template reads.
+  size_t size() const { return s.size; }
+
+  /// Return the entries added so far.
+  const std::vector<vk::DescriptorUpdateTemplateEntry> &entries() const { return s.entries; }
+
+  /// Create a self-deleting template for updating sets with this layout.
+  vk::UniqueDescriptorUpdateTemplate createUnique(vk::Device device, vk::DescriptorSetLayout layout) const {
+    vk::DescriptorUpdateTemplateCreateInfo ci{};
+    ci.descriptorUpdateEntryCount = (uint32_t)s.entries.size();
+    ci.pDescriptorUpdateEntries = s.entries.data();
+    ci.templateType = vk::DescriptorUpdateTemplateType::eDescriptorSet;
+    ci.descriptorSetLayout = layout;
+    return device.createDescriptorUpdateTemplateUnique(ci);
+  }
+
+  /// Size of the info structure consumed for each descriptor of a type.
+  static size_t infoSize(vk::DescriptorType descriptorType) {
+    typedef vk::DescriptorType dt;
+    switch (descriptorType) {
+      case dt::eUniformBuffer:
+      case dt::eStorageBuffer:
+      case dt::eUniformBufferDynamic:
+      case dt::eStorageBufferDynamic: return sizeof(vk::DescriptorBufferInfo);
+      case dt::eUniformTexelBuffer:
+      case dt::eStorageTexelBuffer: return sizeof(vk::BufferView);
+      default: return sizeof(vk::DescriptorImageInfo);
+    }
+  }
+
+  /// Alignment of the info structure consumed for each descriptor of a type.
+  static size_t infoAlignment(vk::DescriptorType descriptorType) {
+    typedef vk::DescriptorType dt;
+    switch (descriptorType) {
+      case dt::eUniformBuffer:
+      case dt::eStorageBuffer:
+      case dt::eUniformBufferDynamic:
+      case dt::eStorageBufferDynamic: return alignof(vk::DescriptorBufferInfo);
+      case dt::eUniformTexelBuffer:
+      case dt::eStorageTexelBuffer: return alignof(vk::BufferView);
+      default: return alignof(vk::DescriptorImageInfo);
+    }
+  }
+
+private:
+  struct State {
+    std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+    size_t size = 0;
+  };
+
+  State s;
+};
+
+/// Update a descriptor set from a packed structure using a template.
+/// This is a single driver call with no intermediate vk::WriteDescriptorSet array.
+template <class Data>
+inline void updateDescriptorSet(vk::Device device, vk::DescriptorSet set, vk::DescriptorUpdateTemplate tmpl, const Data &data) {
+  device.updateDescriptorSetWithTemplate(set, tmpl, (const void*)&data);
+  VKU_COUNT(descriptorWrites, 1);
+}
+
 /// A factory class for descriptor sets (A set of uniform bindings)
 class DescriptorSetMaker {
 public:
@@ -1190,6 +1936,9 @@ public:
     return device.allocateDescriptorSetsUnique(dsai);
   }
 
+  /// Return the layouts added so far.
+  const std::vector<vk::DescriptorSetLayout> &layouts() const { return s.layouts; }
+
 private:
   struct State {
     std::vector<vk::DescriptorSetLayout> layouts;
@@ -1198,6 +1947,729 @@ private:
   State s;
 };
 
+/// A growable list of descriptor pools.
+/// When the current pool runs out of sets or descriptors, a new pool is created
+/// and the allocation is retried, so large scenes do not need to size pools up front.
+/// example:
+///     vku::DescriptorAllocator alloc{device};
+///     auto set = alloc.allocate(*layout);
+///     ...
+///     alloc.reset(); // return every set to the pools in one call.
+class DescriptorAllocator {
+public:
+  DescriptorAllocator() {
+  }
+
+  /// Make an allocator whose pools each hold maxSets descriptor sets.
+  /// Sets are not freed individually, they are all returned with reset().
+  /// flags are passed to each new pool, eg. eUpdateAfterBindPoolEXT.
+  DescriptorAllocator(vk::Device device, uint32_t maxSets = 256, vk::DescriptorPoolCreateFlags flags = vk::DescriptorPoolCreateFlags{}) {
+    s.device = device;
+    s.maxSets = maxSets;
+    s.flags = flags;
+
+    // Descriptors per set for each pool.
+    // Call poolSize() to change these before the first allocation.
+    typedef vk::DescriptorType dt;
+    s.ratios = {
+      {dt::eUniformBuffer, 2.0f},
+      {dt::eUniformBufferDynamic, 1.0f},
+      {dt::eStorageBuffer, 2.0f},
+      {dt::eStorageBufferDynamic, 1.0f},
+      {dt::eCombinedImageSampler, 4.0f},
+      {dt::eSampledImage, 4.0f},
+      {dt::eSampler, 1.0f},
+      {dt::eStorageImage, 1.0f},
+      {dt::eUniformTexelBuffer, 1.0f},
+      {dt::eStorageTexelBuffer, 1.0f},
+      {dt::eInputAttachment, 1.0f},
+    };
+  }
+
+  DescriptorAllocator(DescriptorAllocator &&rhs) = default;
+  DescriptorAllocator &operator=(DescriptorAllocator &&rhs) = default;
+
+  /// Set the number of descriptors of a type to reserve for each set in new pools.
+  /// Zero removes the type from new pools.
+  void poolSize(vk::DescriptorType descriptorType, float descriptorsPerSet) {
+    for (auto &r : s.ratios) {
+      if (r.first == descriptorType) {
+        r.second = descriptorsPerSet;
+        return;
+      }
+    }
+    s.ratios.emplace_back(descriptorType, descriptorsPerSet);
+  }
+
+  /// Allocate one descriptor set for each layout.
+  /// A new pool is created if the current one is exhausted or fragmented.
+  std::vector<vk::DescriptorSet> allocate(const std::vector<vk::DescriptorSetLayout> &layouts) {
+    std::vector<vk::DescriptorSet> result(layouts.size());
+    if (layouts.empty()) return result;
+
+    vk::DescriptorSetAllocateInfo dsai{};
+    dsai.descriptorSetCount = (uint32_t)layouts.size();
+    dsai.pSetLayouts = layouts.data();
+
+    // Try the current pool first, then a new or recycled one.
+    for (int attempt = 0; attempt != 2; ++attempt) {
+      if (s.current == s.pools.size()) {
+        nextPool();
+      }
+      dsai.descriptorPool = *s.pools[s.current];
+      auto res = s.device.allocateDescriptorSets(&dsai, result.data());
+      if (res == vk::Result::eSuccess) {
+        return result;
+      } else if (res != vk::Result::eErrorOutOfPoolMemory && res != vk::Result::eErrorFragmentedPool) {
+        vk::throwResultException(res, "vku::DescriptorAllocator::allocate");
+      }
+      s.current++;
+    }
+
+    // A fresh pool could not hold the request. Set maxSets or poolSize() larger.
+    vk::throwResultException(vk::Result::eErrorOutOfPoolMemory, "vku::DescriptorAllocator::allocate");
+    return result;
+  }
+
+  /// Allocate a single descriptor set.
+  vk::DescriptorSet allocate(vk::DescriptorSetLayout layout) {
+    return allocate(std::vector<vk::DescriptorSetLayout>{layout})[0];
+  }
+
+  /// Allocate the sets described by a DescriptorSetMaker.
+  std::vector<vk::DescriptorSet> allocate(const DescriptorSetMaker &dsm) {
+    return allocate(dsm.layouts());
+  }
+
+  /// Return every set to the pools with vkResetDescriptorPool.
+  /// The pools are kept and reused, so steady state use does no pool creation at all.
+  /// The GPU must have finished with the sets before calling this.
+  void reset() {
+    for (auto &pool : s.pools) {
+      s.device.resetDescriptorPool(*pool);
+    }
+    s.current = 0;
+  }
+
+  /// Return the pool used for the most recent allocation.
+  vk::DescriptorPool currentPool() const { return s.current < s.pools.size() ? *s.pools[s.current] : vk::DescriptorPool{}; }
+
+  /// Return the number of pools created so far.
+  size_t numPools() const { return s.pools.size(); }
+
+private:
+  void nextPool() {
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    for (auto &r : s.ratios) {
+      auto count = (uint32_t)(r.second * s.maxSets);
+      if (count) poolSizes.emplace_back(r.first, count);
+    }
+
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo{};
+    descriptorPoolInfo.flags = s.flags;
+    descriptorPoolInfo.maxSets = s.maxSets;
+    descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    s.pools.push_back(s.device.createDescriptorPoolUnique(descriptorPoolInfo));
+    s.current = s.pools.size() - 1;
+  }
+
+  struct State {
+    vk::Device device;
+    uint32_t maxSets = 256;
+    vk::DescriptorPoolCreateFlags flags;
+    std::vector<std::pair<vk::DescriptorType, float> > ratios;
+    std::vector<vk::UniqueDescriptorPool> pools;
+    size_t current = 0;
+  };
+
+  State s;
+};
+
+/// A set of descriptor allocators, one per frame in flight.
+/// Descriptor sets for a frame are allocated and written every frame and
+/// released wholesale with vkResetDescriptorPool when the frame comes round again.
+/// This is much faster than freeing individual sets and never fragments.
+/// example:
+///     vku::FrameDescriptorAllocator frameAlloc{device, window.numImageIndices()};
+///     window.draw(device, queue, [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
+///       frameAlloc.beginFrame(imageIndex);
+///       auto set = frameAlloc.allocate(*layout);
+///       ...
+///     });
+class FrameDescriptorAllocator {
+public:
+  FrameDescriptorAllocator() {
+  }
+
+  FrameDescriptorAllocator(vk::Device device, int framesInFlight, uint32_t maxSets = 256) {
+    for (int i = 0; i != framesInFlight; ++i) {
+      frames_.emplace_back(device, maxSets);
+    }
+  }
+
+  /// Start allocating for a frame. All sets previously allocated for this frame are released.
+  /// Call this after waiting for the frame's fence.
+  void beginFrame(int frameIndex) {
+    frame_ = frameIndex;
+    frames_[frame_].reset();
+  }
+
+  /// Set the number of descriptors of a type to reserve for each set in new pools.
+  void poolSize(vk::DescriptorType descriptorType, float descriptorsPerSet) {
+    for (auto &f : frames_) f.poolSize(descriptorType, descriptorsPerSet);
+  }
+
+  /// Allocate one descriptor set for each layout in the current frame.
+  std::vector<vk::DescriptorSet> allocate(const std::vector<vk::DescriptorSetLayout> &layouts) {
+    return frames_[frame_].allocate(layouts);
+  }
+
+  /// Allocate a single descriptor set in the current frame.
+  vk::DescriptorSet allocate(vk::DescriptorSetLayout layout) {
+    return frames_[frame_].allocate(layout);
+  }
+
+  /// Return the allocator for the current frame.
+  DescriptorAllocator &current() { return frames_[frame_]; }
+
+  /// Return the number of frames in flight.
+  int numFrames() const { return (int)frames_.size(); }
+
+private:
+  std::vector<DescriptorAllocator> frames_;
+  int frame_ = 0;
+};
+
+/// Write per-draw descriptors straight into a command buffer with VK_KHR_push_descriptor.
+/// This avoids allocating and updating a descriptor set for resources that change every draw.
+/// When the extension is not enabled, sets come from a per-frame allocator instead
+/// and are bound as usual, so the calling code is the same either way.
+/// example:
+///     vku::PushDescriptorRecorder pdr{device, fw.pushDescriptor(), window.numImageIndices()};
+///     vku::DescriptorSetLayoutMaker dslm{};
+///     dslm.flags(pdr.layoutFlags());
+///     dslm.buffer(0, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex, 1);
+///     auto layout = dslm.createUnique(device);
+///     ...
+///     pdr.beginFrame(imageIndex);
+///     for (auto &obj : objects) {
+///       pdr.begin(*layout);
+///       pdr.beginBuffers(0, 0, vk::DescriptorType::eUniformBuffer);
+///       pdr.buffer(obj.ubo.buffer(), 0, sizeof(Uniform));
+///       pdr.push(cb, vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0);
+///       cb.drawIndexed(...);
+///     }
+///
+/// Push descriptor layouts are limited to maxPushDescriptors (at least 32) descriptors.
+class PushDescriptorRecorder {
+public:
+  PushDescriptorRecorder() {
+  }
+
+  /// Use push descriptors if enabled is true and the device has vkCmdPushDescriptorSetKHR,
+  /// otherwise allocate sets from framesInFlight descriptor pools.
+  PushDescriptorRecorder(vk::Device device, bool enabled, int framesInFlight, int maxBuffers = 16, int maxImages = 16) :
+    update_(maxBuffers, maxImages) {
+    device_ = device;
+    if (enabled) {
+      vkCmdPushDescriptorSetKHR_ = (PFN_vkCmdPushDescriptorSetKHR)device.getProcAddr("vkCmdPushDescriptorSetKHR");
+    }
+    if (!vkCmdPushDescriptorSetKHR_) {
+      fallback_ = FrameDescriptorAllocator(device, framesInFlight);
+    }
+  }
+
+  /// Return true if descriptors are pushed into the command buffer rather than allocated.
+  bool pushing() const { return vkCmdPushDescriptorSetKHR_ != nullptr; }
+
+  /// Return the flags to give to DescriptorSetLayoutMaker::flags() for layouts used with push().
+  vk::DescriptorSetLayoutCreateFlags layoutFlags() const {
+    return pushing() ? vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR : vk::DescriptorSetLayoutCreateFlags{};
+  }
+
+  /// Start a frame. Without push descriptors this releases the sets allocated for this frame last time round.
+  void beginFrame(int frameIndex) {
+    if (!pushing()) fallback_.beginFrame(frameIndex);
+  }
+
+  /// Begin the descriptors for one draw using a layout made with layoutFlags().
+  void begin(vk::DescriptorSetLayout layout) {
+    update_.clear();
+    update_.beginDescriptorSet(pushing() ? vk::DescriptorSet{} : fallback_.allocate(layout));
+  }
+
+  /// Call this to start defining buffers.
+  void beginBuffers(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
+    update_.beginBuffers(dstBinding, dstArrayElement, descriptorType);
+  }
+
+  /// Call this to add a new buffer.
+  void buffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+    update_.buffer(buffer, offset, range);
+  }
+
+  /// Call this to begin a new set of images.
+  void beginImages(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
+    update_.beginImages(dstBinding, dstArrayElement, descriptorType);
+  }
+
+  /// Call this to add a combined image sampler.
+  void image(vk::Sampler sampler, vk::ImageView imageView, vk::ImageLayout imageLayout) {
+    update_.image(sampler, imageView, imageLayout);
+  }
+
+  /// Record the descriptors into the command buffer as set number "set" of the pipeline layout.
+  void push(vk::CommandBuffer cb, vk::PipelineBindPoint pipelineBindPoint, vk::PipelineLayout pipelineLayout, uint32_t set) {
+    auto &writes = update_.writes();
+    if (pushing()) {
+      vkCmdPushDescriptorSetKHR_(
+        cb, (VkPipelineBindPoint)pipelineBindPoint, pipelineLayout, set,
+        (uint32_t)writes.size(), (const VkWriteDescriptorSet*)writes.data()
+      );
+      VKU_COUNT(descriptorWrites, writes.size());
+    } else if (!writes.empty()) {
+      update_.update(device_);
+      cb.bindDescriptorSets(pipelineBindPoint, pipelineLayout, set, writes[0].dstSet, nullptr);
+    }
+    update_.clear();
+  }
+
+  /// Returns true if no buffer or image overflowed the limits given in the constructor.
+  bool ok() const { return update_.ok(); }
+
+private:
+  vk::Device device_;
+  PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR_ = nullptr;
+  FrameDescriptorAllocator fallback_;
+  DescriptorSetUpdater update_;
+};
+
+/// A bindless table of textures and samplers.
+/// Every texture lives in one large, partially bound array of sampled images and every
+/// sampler in a second array, so a whole scene can be drawn with a single descriptor set bind.
+/// Registering a texture returns a stable index which shaders read from push constants.
+/// example:
+///     vku::BindlessTextureTable table{device};
+///     uint32_t brick = table.add(brickTexture.imageView());
+///     uint32_t linear = table.addSampler(*sampler);
+///     ...
+///     cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, table.descriptorSet(), nullptr);
+///     cb.pushConstants(*pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(indices), &indices);
+///
+/// In the shader (GL_EXT_nonuniform_qualifier):
+///     layout(set = 0, binding = 0) uniform texture2D textures[];
+///     layout(set = 0, binding = 1) uniform sampler samplers[];
+///     ...
+///     texture(sampler2D(textures[nonuniformEXT(pc.texture)], samplers[pc.sampler]), uv);
+///
+/// Needs VK_EXT_descriptor_indexing (core in Vulkan 1.2) and shaderSampledImageArrayDynamicIndexing
+/// for samplers[pc.sampler]; Framework enables both, see Framework::descriptorIndexing().
+class BindlessTextureTable {
+public:
+  BindlessTextureTable() {
+  }
+
+  /// Make a table with room for maxTextures images and maxSamplers samplers.
+  /// These must be within maxDescriptorSetUpdateAfterBindSampledImages and
+  /// maxDescriptorSetUpdateAfterBindSamplers from PhysicalDeviceDescriptorIndexingPropertiesEXT.
+  BindlessTextureTable(vk::Device device, uint32_t maxTextures = 4096, uint32_t maxSamplers = 64, vk::ShaderStageFlags stageFlags = vk::ShaderStageFlagBits::eAll) {
+    s.device = device;
+    s.maxTextures = maxTextures;
+    s.maxSamplers = maxSamplers;
+
+    // Unwritten elements are allowed and elements may be written while the set is bound.
+    typedef vk::DescriptorBindingFlagBitsEXT bf;
+    vk::DescriptorBindingFlagsEXT flags = bf::ePartiallyBound|bf::eUpdateAfterBind;
+
+    DescriptorSetLayoutMaker dslm{};
+    dslm.flags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT);
+    dslm.image(textureBinding, vk::DescriptorType::eSampledImage, stageFlags, maxTextures);
+    dslm.bindingFlags(flags);
+    dslm.image(samplerBinding, vk::DescriptorType::eSampler, stageFlags, maxSamplers);
+    dslm.bindingFlags(flags);
+    s.layout = dslm.createUnique(device);
+
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    poolSizes.emplace_back(vk::DescriptorType::eSampledImage, maxTextures);
+    poolSizes.emplace_back(vk::DescriptorType::eSampler, maxSamplers);
+
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo{};
+    descriptorPoolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    s.pool = device.createDescriptorPoolUnique(descriptorPoolInfo);
+
+    DescriptorSetMaker dsm{};
+    dsm.layout(*s.layout);
+    s.set = dsm.create(device, *s.pool)[0];
+  }
+
+  BindlessTextureTable(BindlessTextureTable &&rhs) = default;
+  BindlessTextureTable &operator=(BindlessTextureTable &&rhs) = default;
+
+  /// Register an image view and return its index in the texture array.
+  /// Indices of removed textures are reused.
+  uint32_t add(vk::ImageView imageView, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    uint32_t index = 0;
+    if (!s.freeTextures.empty()) {
+      index = s.freeTextures.back();
+      s.freeTextures.pop_back();
+    } else if (s.numTextures != s.maxTextures) {
+      index = s.numTextures++;
+    } else {
+      vk::throwResultException(vk::Result::eErrorOutOfPoolMemory, "vku::BindlessTextureTable::add");
+    }
+    set(index, imageView, imageLayout);
+    return index;
+  }
+
+  /// Replace the image view at an index, eg. when streaming in a higher resolution mip chain.
+  /// This is allowed while the set is bound as long as in-flight frames do not read this index.
+  void set(uint32_t index, vk::ImageView imageView, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    vk::DescriptorImageInfo info{vk::Sampler{}, imageView, imageLayout};
+    vk::WriteDescriptorSet write{s.set, textureBinding, index, 1, vk::DescriptorType::eSampledImage, &info};
+    s.device.updateDescriptorSets(write, nullptr);
+    VKU_COUNT(descriptorWrites, 1);
+  }
+
+  /// Release an index for reuse.
+  /// The GPU must have finished with any frame that reads this index.
+  void remove(uint32_t index) {
+    s.freeTextures.push_back(index);
+  }
+
+  /// Register a sampler and return its index in the sampler array.
+  uint32_t addSampler(vk::Sampler sampler) {
+    if (s.numSamplers == s.maxSamplers) {
+      vk::throwResultException(vk::Result::eErrorOutOfPoolMemory, "vku::BindlessTextureTable::addSampler");
+    }
+    uint32_t index = s.numSamplers++;
+    vk::DescriptorImageInfo info{sampler, vk::ImageView{}, vk::ImageLayout::eUndefined};
+    vk::WriteDescriptorSet write{s.set, samplerBinding, index, 1, vk::DescriptorType::eSampler, &info};
+    s.device.updateDescriptorSets(write, nullptr);
+    VKU_COUNT(descriptorWrites, 1);
+    return index;
+  }
+
+  /// Return the layout to use in PipelineLayoutMaker::descriptorSetLayout.
+  vk::DescriptorSetLayout layout() const { return *s.layout; }
+
+  /// Return the one descriptor set holding every texture and sampler.
+  vk::DescriptorSet descriptorSet() const { return s.set; }
+
+  /// Return the number of texture slots in use, including removed ones awaiting reuse.
+  uint32_t numTextures() const { return s.numTextures; }
+
+  /// Return the number of samplers registered.
+  uint32_t numSamplers() const { return s.numSamplers; }
+
+  /// Binding of the sampled image array.
+  static const uint32_t textureBinding = 0;
+
+  /// Binding of the sampler array.
+  static const uint32_t samplerBinding = 1;
+
+private:
+  struct State {
+    vk::Device device;
+    vk::UniqueDescriptorSetLayout layout;
+    vk::UniqueDescriptorPool pool;
+    vk::DescriptorSet set;
+    std::vector<uint32_t> freeTextures;
+    uint32_t maxTextures = 0;
+    uint32_t maxSamplers = 0;
+    uint32_t numTextures = 0;
+    uint32_t numSamplers = 0;
+  };
+
+  State s;
+};
+
+/// The result of ComputeKernel::run().
+/// wait() blocks on the job's fence and copies any readback data to host memory.
+/// The destructor waits too, so a job can not outlive its staging buffer.
+class ComputeFuture {
+public:
+  ComputeFuture() {
+  }
+
+  ComputeFuture(vk::Device device, vk::Fence fence, GenericBuffer &&staging, void *dst, vk::DeviceSize size) :
+    device_(device), fence_(fence), staging_(std::move(staging)), dst_(dst), size_(size) {
+  }
+
+  ComputeFuture(ComputeFuture &&rhs) {
+    *this = std::move(rhs);
+  }
+
+  ComputeFuture &operator=(ComputeFuture &&rhs) {
+    wait();
+    device_ = rhs.device_;
+    fence_ = rhs.fence_;
+    staging_ = std::move(rhs.staging_);
+    dst_ = rhs.dst_;
+    size_ = rhs.size_;
+    rhs.fence_ = vk::Fence{};
+    return *this;
+  }
+
+  ~ComputeFuture() {
+    wait();
+  }
+
+  /// Returns true if the GPU has finished the job.
+  bool ready() const {
+    return !fence_ || device_.getFenceStatus(fence_) == vk::Result::eSuccess;
+  }
+
+  /// Wait for the GPU to finish and copy the readback buffer, if any, to host memory.
+  void wait() {
+    if (!fence_) return;
+    device_.waitForFences(fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    if (dst_) {
+      staging_.invalidate(device_);
+      memcpy(dst_, staging_.map(device_), (size_t)size_);
+      staging_.unmap(device_);
+    }
+    fence_ = vk::Fence{};
+  }
+
+private:
+  vk::Device device_;
+  vk::Fence fence_;
+  GenericBuffer staging_;
+  void *dst_ = nullptr;
+  vk::DeviceSize size_ = 0;
+};
+
+/// A compute shader bundled with its reflected bindings, layouts and pipeline.
+/// Buffer arguments are bound in order of the reflected binding numbers of descriptor set 0.
+/// example:
+///     vku::ComputeKernel add{device, memprops, queueFamilyIndex, vku::ShaderModule{device, "add.comp.spv"}};
+///     add.pushConstants(n);
+///
+///     // Record into your own command buffer:
+///     add.dispatch(cb, (n + 63) / 64, 1, 1, a, b, result);
+///
+///     // Or run asynchronously and read the result back:
+///     std::vector<float> host(n);
+///     auto future = add.run(queue, host.data(), result, (n + 63) / 64, 1, 1, a, b, result);
+///     ... do other work ...
+///     future.wait();
+///
+/// Each run() uses one of maxJobsInFlight slots, each with its own command buffer, fence and
+/// descriptor pool, so steady state jobs allocate nothing but the readback staging buffer.
+/// Futures must not outlive their kernel.
+class ComputeKernel {
+public:
+  ComputeKernel() {
+  }
+
+  /// Build the layouts and pipeline for a compute shader.
+  /// specialization gives values for constant_id 0, 1, 2... By convention constant 0
+  /// is the workgroup size (local_size_x_id = 0) and is used by groupsFor().
+  ComputeKernel(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, ShaderModule &&shader, uint32_t pushConstantSize = 0, const std::vector<uint32_t> &specialization = std::vector<uint32_t>{}, int maxJobsInFlight = 4, vk::PipelineCache pipelineCache = vk::PipelineCache{}) {
+    s.device = device;
+    s.memprops = memprops;
+    s.shader = std::move(shader);
+    s.pushConstantSize = pushConstantSize;
+    s.specialization = specialization;
+    s.localSize = s.shader.localSize();
+    if (!specialization.empty()) {
+      s.localSize[0] = specialization[0];
+    }
+
+    // Descriptor set 0 of the shader, in binding order.
+    for (auto &v : s.shader.getVariables()) {
+      if (v.isDescriptor && v.set == 0) {
+        s.bindings.emplace_back((uint32_t)v.binding, v.descriptorType, std::max(v.descriptorCount, 1u), vk::ShaderStageFlagBits::eCompute, nullptr);
+      }
+    }
+    std::sort(s.bindings.begin(), s.bindings.end(), [](const vk::DescriptorSetLayoutBinding &a, const vk::DescriptorSetLayoutBinding &b) { return a.binding < b.binding; });
+
+    DescriptorSetLayoutMaker dslm{};
+    for (auto &b : s.bindings) {
+      dslm.buffer(b.binding, b.descriptorType, b.stageFlags, b.descriptorCount);
+    }
+    s.descriptorSetLayout = dslm.createUnique(device);
+
+    PipelineLayoutMaker plm{};
+    plm.descriptorSetLayout(*s.descriptorSetLayout);
+    if (pushConstantSize) {
+      plm.pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, pushConstantSize);
+    }
+    s.pipelineLayout = plm.createUnique(device);
+
+    ComputePipelineMaker cpm{};
+    cpm.shader(vk::ShaderStageFlagBits::eCompute, s.shader);
+    for (size_t i = 0; i != specialization.size(); ++i) {
+      cpm.specializationConstant((uint32_t)i, specialization[i]);
+    }
+    s.pipeline = cpm.createUnique(device, pipelineCache, *s.pipelineLayout);
+
+    // One command buffer, fence and descriptor pool per job in flight.
+    vk::CommandPoolCreateInfo cpci{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndex};
+    s.commandPool = device.createCommandPoolUnique(cpci);
+    vk::CommandBufferAllocateInfo cbai{*s.commandPool, vk::CommandBufferLevel::ePrimary, (uint32_t)maxJobsInFlight};
+    s.commandBuffers = device.allocateCommandBuffersUnique(cbai);
+    for (int i = 0; i != maxJobsInFlight; ++i) {
+      s.fences.push_back(device.createFenceUnique(vk::FenceCreateInfo{vk::FenceCreateFlagBits::eSignaled}));
+    }
+    s.sets = FrameDescriptorAllocator(device, maxJobsInFlight, 16);
+    s.update = DescriptorSetUpdater((int)s.bindings.size(), 0);
+  }
+
+  /// Set the push constants used by following dispatches.
+  template <class Type>
+  void pushConstants(const Type &value) {
+    s.pushConstants.resize(sizeof(value));
+    memcpy(s.pushConstants.data(), &value, sizeof(value));
+  }
+
+  /// Set the push constants from raw bytes.
+  void pushConstants(const void *value, size_t size) {
+    s.pushConstants.resize(size);
+    if (size) memcpy(s.pushConstants.data(), value, size);
+  }
+
+  /// For dispatch() into your own command buffers: release the descriptor sets of a frame.
+  /// Do not mix this with run().
+  void beginFrame(int frameIndex) {
+    s.sets.beginFrame(frameIndex);
+  }
+
+  /// Record a dispatch of groupsX * groupsY * groupsZ workgroups using the buffers in binding order.
+  /// Add barriers as needed before and after.
+  template <class ... Buffers>
+  void dispatch(vk::CommandBuffer cb, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ, const Buffers &... buffers) {
+    const GenericBuffer *args[] = {&buffers..., nullptr};
+    vk::DescriptorSet set = allocateDescriptorSet();
+
+    auto &update = s.update;
+    update.clear();
+    update.beginDescriptorSet(set);
+    for (size_t i = 0; i != s.bindings.size() && args[i]; ++i) {
+      update.beginBuffers(s.bindings[i].binding, 0, s.bindings[i].descriptorType);
+      update.buffer(args[i]->buffer(), 0, VK_WHOLE_SIZE);
+    }
+    update.update(s.device);
+    dispatch(cb, set, groupsX, groupsY, groupsZ);
+  }
+
+  /// Allocate a descriptor set for this frame, for kernels that bind images or buffer ranges.
+  /// Write it with a DescriptorSetUpdater and pass it to dispatch().
+  vk::DescriptorSet allocateDescriptorSet() {
+    return s.sets.allocate(*s.descriptorSetLayout);
+  }
+
+  /// Record a dispatch using a descriptor set you have written.
+  template <class Dispatch = vk::DispatchLoaderStatic>
+  void dispatch(vk::CommandBuffer cb, vk::DescriptorSet set, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ, const Dispatch &d = Dispatch()) {
+    cb.bindPipeline(vk::PipelineBindPoint::eCompute, *s.pipeline, d);
+    cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *s.pipelineLayout, 0, set, nullptr, d);
+    if (!s.pushConstants.empty()) {
+      cb.pushConstants(*s.pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, (uint32_t)s.pushConstants.size(), s.pushConstants.data(), d);
+    }
+    cb.dispatch(groupsX, groupsY, groupsZ, d);
+  }
+
+  /// Submit a dispatch to a queue without waiting for it.
+  template <class ... Buffers>
+  ComputeFuture run(vk::Queue queue, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ, const Buffers &... buffers) {
+    vk::CommandBuffer cb = beginJob();
+    dispatch(cb, groupsX, groupsY, groupsZ, buffers...);
+    return endJob(queue, cb, nullptr, nullptr);
+  }
+
+  /// Submit a dispatch and copy readback.size() bytes of readback into dst when it is done.
+  template <class ... Buffers>
+  ComputeFuture run(vk::Queue queue, void *dst, const GenericBuffer &readback, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ, const Buffers &... buffers) {
+    vk::CommandBuffer cb = beginJob();
+    dispatch(cb, groupsX, groupsY, groupsZ, buffers...);
+    return endJob(queue, cb, dst, &readback);
+  }
+
+  /// Return the number of workgroups needed to cover numItems invocations in x.
+  uint32_t groupsFor(uint32_t numItems) const {
+    return (numItems + s.localSize[0] - 1) / s.localSize[0];
+  }
+
+  /// Return the reflected bindings of descriptor set 0 in binding order.
+  const std::vector<vk::DescriptorSetLayoutBinding> &bindings() const { return s.bindings; }
+
+  vk::DescriptorSetLayout descriptorSetLayout() const { return *s.descriptorSetLayout; }
+  vk::PipelineLayout pipelineLayout() const { return *s.pipelineLayout; }
+  vk::Pipeline pipeline() const { return *s.pipeline; }
+
+  /// Return what the kernel was built from, and the push constants set for following dispatches.
+  const ShaderModule &shader() const { return s.shader; }
+  uint32_t pushConstantSize() const { return s.pushConstantSize; }
+  const std::vector<uint32_t> &specialization() const { return s.specialization; }
+  const std::vector<uint8_t> &pushConstantData() const { return s.pushConstants; }
+
+private:
+  // Wait for the oldest job slot and start recording into its command buffer.
+  vk::CommandBuffer beginJob() {
+    s.job = (s.job + 1) % (int)s.fences.size();
+    vk::Fence fence = *s.fences[s.job];
+    s.device.waitForFences(fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    s.device.resetFences(fence);
+    s.sets.beginFrame(s.job);
+
+    vk::CommandBuffer cb = *s.commandBuffers[s.job];
+    cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    return cb;
+  }
+
+  // Add the readback copy, submit and return a future for the job.
+  ComputeFuture endJob(vk::Queue queue, vk::CommandBuffer cb, void *dst, const GenericBuffer *readback) {
+    GenericBuffer staging;
+    vk::DeviceSize size = 0;
+    if (readback) {
+      size = readback->size();
+      staging = GenericBuffer(s.device, s.memprops, vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eHostVisible);
+
+      typedef vk::PipelineStageFlagBits psflags;
+      typedef vk::AccessFlagBits aflags;
+      readback->barrier(cb, psflags::eComputeShader, psflags::eTransfer, {}, aflags::eShaderWrite, aflags::eTransferRead, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+      cb.copyBuffer(readback->buffer(), staging.buffer(), vk::BufferCopy{0, 0, size});
+      staging.barrier(cb, psflags::eTransfer, psflags::eHost, {}, aflags::eTransferWrite, aflags::eHostRead, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+    }
+    cb.end();
+
+    vk::Fence fence = *s.fences[s.job];
+    vk::SubmitInfo submit;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &cb;
+    queue.submit(submit, fence);
+    VKU_COUNT(queueSubmits, 1);
+    return ComputeFuture(s.device, fence, std::move(staging), dst, size);
+  }
+
+  struct State {
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memprops;
+    ShaderModule shader;
+    uint32_t pushConstantSize = 0;
+    std::vector<uint32_t> specialization;
+    std::array<uint32_t, 3> localSize;
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniquePipelineLayout pipelineLayout;
+    vk::UniquePipeline pipeline;
+    vk::UniqueCommandPool commandPool;
+    std::vector<vk::UniqueCommandBuffer> commandBuffers;
+    std::vector<vk::UniqueFence> fences;
+    FrameDescriptorAllocator sets;
+    DescriptorSetUpdater update;
+    std::vector<uint8_t> pushConstants;
+    int job = 0;
+  };
+
+  State s;
+};
+
 /// Generic image with a view and memory object.
 /// Vulkan images need a memory object to hold the data and a view object for the GPU to access the data.
 class GenericImage {
@@ -1272,6 +2744,7 @@ public:
   void upload(vk::Device device, std::vector<uint8_t> &bytes, vk::CommandPool commandPool, vk::PhysicalDeviceMemoryProperties memprops, vk::Queue queue) {
     vku::GenericBuffer stagingBuffer(device, memprops, (vk::BufferUsageFlags)vk::BufferUsageFlagBits::eTransferSrc, (vk::DeviceSize)bytes.size(), vk::MemoryPropertyFlagBits::eHostVisible);
     stagingBuffer.updateLocal(device, (const void*)bytes.data(), bytes.size());
+    VKU_COUNT(stagingBytes, bytes.size());
 
     // Copy the staging buffer to the GPU texture and set the layout.
     vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
@@ -1348,6 +2821,7 @@ public:
     auto memoryBarriers = nullptr;
     auto bufferMemoryBarriers = nullptr;
     cb.pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, memoryBarriers, bufferMemoryBarriers, imageMemoryBarriers);
+    VKU_COUNT(barriers, 1);
   }
 
   /// Set what the image thinks is its current layout (ie. the old layout in an image barrier).
@@ -1375,6 +2849,7 @@ protected:
     mai.allocationSize = s.size = memreq.size;
     mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, search);
     s.mem = device.allocateMemoryUnique(mai);
+    countAllocation(memprops, (int)mai.memoryTypeIndex, mai.allocationSize);
 
     device.bindImageMemory(*s.image, *s.mem, 0);
 
@@ -1699,6 +3174,7 @@ public:
   void upload(vk::Device device, vku::GenericImage &image, std::vector<uint8_t> &bytes, vk::CommandPool commandPool, vk::PhysicalDeviceMemoryProperties memprops, vk::Queue queue) {
     vku::GenericBuffer stagingBuffer(device, memprops, (vk::BufferUsageFlags)vk::BufferUsageFlagBits::eTransferSrc, (vk::DeviceSize)bytes.size(), vk::MemoryPropertyFlagBits::eHostVisible);
     stagingBuffer.updateLocal(device, (const void*)bytes.data(), bytes.size());
+    VKU_COUNT(stagingBytes, bytes.size());
 
     // Copy the staging buffer to the GPU texture and set the layout.
     vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
@@ -0,0 +1,491 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Command stream capture for the Vookoo high level C++ Vulkan interface.
+//
+// vku::Capture writes buffers, their contents, compute kernels with their SPIR-V
+// and the commands recorded through it to a compact binary trace.
+// vku::CaptureReplay runs a trace again on any device without a window, so a
+// captured frame can be timed repeatedly, eg. with bench-replay on a software ICD.
+//
+// A trace is a header {magic, version} followed by records of
+// {op, payload words, payload}, all in 32 bit words. Byte data such as buffer
+// contents comes last in a payload, padded to a whole word.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_CAPTURE_HPP
+#define VKU_CAPTURE_HPP
+
+#include <vku/vku.hpp>
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+
+namespace vku {
+
+/// Record types in a capture trace and their payloads. 64 bit values take two words, low first.
+enum class CaptureOp : uint32_t {
+  /// id, size64
+  buffer = 1,
+
+  /// buffer id, offset64, size64, bytes
+  upload = 2,
+
+  /// id, push constant size, specialization count, specialization constants, SPIR-V
+  kernel = 3,
+
+  /// kernel id, groups x, y and z, buffer count, buffer ids, push constant size, bytes
+  dispatch = 4,
+
+  /// source stages, destination stages, source access, destination access
+  barrier = 5,
+
+  /// source id, destination id, source offset64, destination offset64, size64
+  copyBuffer = 6,
+
+  /// buffer id, offset64, size64, value
+  fillBuffer = 7,
+
+  /// no payload: the commands so far are submitted together
+  endFrame = 8,
+};
+
+/// Records buffer and compute work into a trace file.
+/// While capturing, call the Capture's methods in place of the vku calls they wrap.
+/// Buffers are added the first time they are used. Host visible buffers written through
+/// map() are not seen: use upload(), or contents() to capture what a buffer holds.
+/// example:
+///     vku::Capture capture{"frame.vkutrace"};
+///     capture.contents(device, memprops, commandPool, queue, instances);
+///     capture.upload(device, memprops, commandPool, queue, params, &p, sizeof(p));
+///     ...
+///     capture.dispatch(cb, cull, cull.groupsFor(n), 1, 1, instances, params, draws);
+///     capture.barrier(cb, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect,
+///       vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+///     ... end and submit cb ...
+///     capture.endFrame();
+class Capture {
+public:
+  Capture() {
+  }
+
+  /// Start a trace file.
+  Capture(const std::string &filename) {
+    file_.open(filename, std::ios::binary);
+    uint32_t header[] = {magic, version};
+    file_.write((const char *)header, sizeof(header));
+    bytesWritten_ = sizeof(header);
+    ok_ = (bool)file_;
+  }
+
+  /// Return the id of a buffer in the trace, adding it if it is new.
+  uint32_t buffer(const GenericBuffer &buffer) {
+    VkBuffer key = buffer.buffer();
+    auto iter = buffers_.find(key);
+    if (iter != buffers_.end()) return iter->second;
+
+    uint32_t id = (uint32_t)buffers_.size();
+    buffers_[key] = id;
+    std::vector<uint32_t> words{id};
+    push64(words, buffer.size());
+    write(CaptureOp::buffer, words);
+    return id;
+  }
+
+  /// Upload to a buffer as GenericBuffer::upload does, recording the bytes.
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const GenericBuffer &buffer, const void *value, vk::DeviceSize size, vk::DeviceSize offset = 0) {
+    buffer.upload(device, memprops, commandPool, queue, value, size, offset);
+    record(buffer, value, size, offset);
+  }
+
+  template<typename T>
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const GenericBuffer &buffer, const std::vector<T> &value) {
+    upload(device, memprops, commandPool, queue, buffer, value.data(), value.size() * sizeof(T));
+  }
+
+  /// Record what a buffer holds now, eg. data written before the capture started.
+  /// The buffer needs eTransferSrc usage. This waits for the device.
+  void contents(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const GenericBuffer &buffer) {
+    vk::DeviceSize size = buffer.size();
+    GenericBuffer staging(device, memprops, vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eHostVisible);
+    executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
+      cb.copyBuffer(buffer.buffer(), staging.buffer(), vk::BufferCopy{0, 0, size});
+    });
+    staging.invalidate(device);
+    record(buffer, staging.map(device), size, 0);
+    staging.unmap(device);
+  }
+
+  /// Return the id of a kernel in the trace, adding it and its SPIR-V if it is new.
+  uint32_t kernel(const ComputeKernel &kernel) {
+    VkPipeline key = kernel.pipeline();
+    auto iter = kernels_.find(key);
+    if (iter != kernels_.end()) return iter->second;
+
+    uint32_t id = (uint32_t)kernels_.size();
+    kernels_[key] = id;
+    auto &spec = kernel.specialization();
+    auto &spirv = kernel.shader().opcodes();
+    std::vector<uint32_t> words{id, kernel.pushConstantSize(), (uint32_t)spec.size()};
+    words.insert(words.end(), spec.begin(), spec.end());
+    write(CaptureOp::kernel, words, spirv.data(), spirv.size() * sizeof(uint32_t));
+    return id;
+  }
+
+  /// Record a dispatch as ComputeKernel::dispatch does, with the kernel's current push constants.
+  template <class ... Buffers>
+  void dispatch(vk::CommandBuffer cb, ComputeKernel &kernel, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ, const Buffers &... buffers) {
+    const GenericBuffer *args[] = {&buffers..., nullptr};
+    std::vector<uint32_t> words{this->kernel(kernel), groupsX, groupsY, groupsZ, (uint32_t)sizeof...(buffers)};
+    for (size_t i = 0; i != sizeof...(buffers); ++i) {
+      words.push_back(buffer(*args[i]));
+    }
+    auto &pushConstants = kernel.pushConstantData();
+    words.push_back((uint32_t)pushConstants.size());
+    write(CaptureOp::dispatch, words, pushConstants.data(), pushConstants.size());
+    kernel.dispatch(cb, groupsX, groupsY, groupsZ, buffers...);
+  }
+
+  /// Record a global memory barrier.
+  void barrier(vk::CommandBuffer cb, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask, vk::AccessFlags srcAccessMask, vk::AccessFlags dstAccessMask) {
+    write(CaptureOp::barrier, {(uint32_t)VkPipelineStageFlags(srcStageMask), (uint32_t)VkPipelineStageFlags(dstStageMask), (uint32_t)VkAccessFlags(srcAccessMask), (uint32_t)VkAccessFlags(dstAccessMask)});
+    cb.pipelineBarrier(srcStageMask, dstStageMask, vk::DependencyFlags{}, vk::MemoryBarrier{srcAccessMask, dstAccessMask}, nullptr, nullptr);
+    VKU_COUNT(barriers, 1);
+  }
+
+  /// Record a copy between buffers.
+  void copyBuffer(vk::CommandBuffer cb, const GenericBuffer &src, const GenericBuffer &dst, const vk::BufferCopy &region) {
+    std::vector<uint32_t> words{buffer(src), buffer(dst)};
+    push64(words, region.srcOffset);
+    push64(words, region.dstOffset);
+    push64(words, region.size);
+    write(CaptureOp::copyBuffer, words);
+    cb.copyBuffer(src.buffer(), dst.buffer(), region);
+  }
+
+  /// Record a fill of a buffer range with a 32 bit value.
+  void fillBuffer(vk::CommandBuffer cb, const GenericBuffer &dst, vk::DeviceSize offset, vk::DeviceSize size, uint32_t value) {
+    std::vector<uint32_t> words{buffer(dst)};
+    push64(words, offset);
+    push64(words, size);
+    words.push_back(value);
+    write(CaptureOp::fillBuffer, words);
+    cb.fillBuffer(dst.buffer(), offset, size, value);
+  }
+
+  /// Mark the end of a frame, after submitting its commands, and flush the file.
+  void endFrame() {
+    write(CaptureOp::endFrame, {});
+    file_.flush();
+  }
+
+  /// Returns true if the trace file is being written.
+  bool ok() const { return ok_ && (bool)file_; }
+
+  /// Return the size of the trace so far.
+  uint64_t bytesWritten() const { return bytesWritten_; }
+
+  static const uint32_t magic = 0x54554b56; // "VKUT"
+  static const uint32_t version = 1;
+
+private:
+  static void push64(std::vector<uint32_t> &words, uint64_t value) {
+    words.push_back((uint32_t)value);
+    words.push_back((uint32_t)(value >> 32));
+  }
+
+  void record(const GenericBuffer &buffer, const void *value, vk::DeviceSize size, vk::DeviceSize offset) {
+    std::vector<uint32_t> words{this->buffer(buffer)};
+    push64(words, offset);
+    push64(words, size);
+    write(CaptureOp::upload, words, value, (size_t)size);
+  }
+
+  void write(CaptureOp op, const std::vector<uint32_t> &words, const void *bytes = nullptr, size_t numBytes = 0) {
+    if (!ok_) return;
+    uint32_t paddedWords = (uint32_t)((numBytes + 3) / 4);
+    uint32_t header[] = {(uint32_t)op, (uint32_t)words.size() + paddedWords};
+    file_.write((const char *)header, sizeof(header));
+    file_.write((const char *)words.data(), words.size() * sizeof(uint32_t));
+    if (numBytes) {
+      uint32_t zero = 0;
+      file_.write((const char *)bytes, numBytes);
+      file_.write((const char *)&zero, paddedWords * 4 - numBytes);
+    }
+    bytesWritten_ += sizeof(header) + (words.size() + paddedWords) * sizeof(uint32_t);
+  }
+
+  std::ofstream file_;
+  std::map<VkBuffer, uint32_t> buffers_;
+  std::map<VkPipeline, uint32_t> kernels_;
+  uint64_t bytesWritten_ = 0;
+  bool ok_ = false;
+};
+
+/// Runs a trace written by Capture on a device.
+/// Buffers and kernels are made when the trace is loaded and each frame is recorded once,
+/// so run() only repeats the frame's uploads and submits its command buffer.
+/// example:
+///     vku::CaptureReplay replay{device, physicalDevice, queueFamilyIndex, "frame.vkutrace"};
+///     for (size_t frame = 0; frame != replay.numFrames(); ++frame) {
+///       replay.run(queue, frame);
+///       std::cout << replay.gpuMs(frame) << "ms\n";
+///     }
+class CaptureReplay {
+public:
+  CaptureReplay() {
+  }
+
+  /// Load a trace and build its buffers, kernels and command buffers.
+  /// ok() is false if the file is missing or not a valid trace.
+  CaptureReplay(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t queueFamilyIndex, const std::string &filename) {
+    device_ = device;
+    memprops_ = physicalDevice.getMemoryProperties();
+    queueFamilyIndex_ = queueFamilyIndex;
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return;
+    file.seekg(0, std::ios::end);
+    size_t length = (size_t)file.tellg();
+    std::vector<uint32_t> trace(length / 4);
+    file.seekg(0, std::ios::beg);
+    file.read((char *)trace.data(), trace.size() * 4);
+    if (trace.size() < 2 || trace[0] != Capture::magic || trace[1] != Capture::version) return;
+
+    vk::CommandPoolCreateInfo cpci{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndex};
+    commandPool_ = device.createCommandPoolUnique(cpci);
+    fence_ = device.createFenceUnique(vk::FenceCreateInfo{});
+    descriptorSets_ = DescriptorAllocator(device);
+
+    // Time each frame if the queue family has timestamps.
+    auto qprops = physicalDevice.getQueueFamilyProperties();
+    if (queueFamilyIndex < qprops.size() && qprops[queueFamilyIndex].timestampValidBits) {
+      timestampPeriod_ = physicalDevice.getProperties().limits.timestampPeriod;
+      timestampMask_ = qprops[queueFamilyIndex].timestampValidBits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << qprops[queueFamilyIndex].timestampValidBits) - 1;
+    }
+
+    const uint32_t *p = trace.data() + 2;
+    const uint32_t *end = trace.data() + trace.size();
+    Frame *frame = nullptr;
+    while (p + 2 <= end) {
+      CaptureOp op = (CaptureOp)p[0];
+      const uint32_t *payload = p + 2;
+      const uint32_t *next = payload + p[1];
+      if (next > end || next < payload) return;
+      if (!frame) frame = beginFrame();
+      if (!replay(op, Reader{payload, next}, *frame)) return;
+      if (op == CaptureOp::endFrame) {
+        endFrame(*frame);
+        frame = nullptr;
+      }
+      p = next;
+    }
+
+    // Commands after the last endFrame still make a frame.
+    if (frame) endFrame(*frame);
+    ok_ = true;
+  }
+
+  /// Repeat a frame's uploads, then submit its commands and wait for them.
+  void run(vk::Queue queue, size_t frame) {
+    Frame &f = frames_[frame];
+    for (auto &u : f.uploads) {
+      buffers_[u.buffer].upload(device_, memprops_, *commandPool_, queue, u.bytes.data(), u.bytes.size(), u.offset);
+    }
+    submit(queue, f.cb, {}, {}, {}, *fence_);
+    device_.waitForFences(*fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    device_.resetFences(*fence_);
+
+    if (timestampPeriod_) {
+      uint64_t ts[2] = {0, 0};
+      device_.getQueryPoolResults(*f.queryPool, 0, 2, sizeof(ts), ts, sizeof(uint64_t), vk::QueryResultFlagBits::e64|vk::QueryResultFlagBits::eWait);
+      f.gpuMs = ((ts[1] - ts[0]) & timestampMask_) * timestampPeriod_ * 1e-6;
+    }
+  }
+
+  /// Return the GPU time of the last run() of a frame in milliseconds, or -1 without timestamps.
+  double gpuMs(size_t frame) const { return frames_[frame].gpuMs; }
+
+  size_t numFrames() const { return frames_.size(); }
+  size_t numBuffers() const { return buffers_.size(); }
+  size_t numKernels() const { return kernels_.size(); }
+
+  /// Get a buffer by its id in the trace, eg. to check results.
+  const GenericBuffer &buffer(uint32_t id) const { return buffers_[id]; }
+
+  /// Returns true if the trace was loaded.
+  bool ok() const { return ok_; }
+
+private:
+  struct Upload {
+    uint32_t buffer;
+    vk::DeviceSize offset;
+    std::vector<uint8_t> bytes;
+  };
+
+  struct Frame {
+    std::vector<Upload> uploads;
+    vk::UniqueCommandBuffer commandBuffer;
+    vk::UniqueQueryPool queryPool;
+    vk::CommandBuffer cb;
+    double gpuMs = -1;
+  };
+
+  // Reads words from a record's payload. Reading past the end sets ok to false.
+  struct Reader {
+    const uint32_t *p;
+    const uint32_t *end;
+    bool ok = true;
+
+    Reader(const uint32_t *p, const uint32_t *end) : p(p), end(end) {
+    }
+
+    uint32_t u32() {
+      if (p == end) { ok = false; return 0; }
+      return *p++;
+    }
+
+    uint64_t u64() {
+      uint64_t lo = u32();
+      return lo | (uint64_t)u32() << 32;
+    }
+
+    const uint8_t *bytes(size_t size) {
+      size_t words = (size + 3) / 4;
+      if ((size_t)(end - p) < words) { ok = false; return nullptr; }
+      const uint8_t *result = (const uint8_t *)p;
+      p += words;
+      return result;
+    }
+  };
+
+  Frame *beginFrame() {
+    frames_.emplace_back();
+    Frame &f = frames_.back();
+    vk::CommandBufferAllocateInfo cbai{*commandPool_, vk::CommandBufferLevel::ePrimary, 1};
+    f.commandBuffer = std::move(device_.allocateCommandBuffersUnique(cbai)[0]);
+    f.cb = *f.commandBuffer;
+    f.cb.begin(vk::CommandBufferBeginInfo{});
+    if (timestampPeriod_) {
+      f.queryPool = device_.createQueryPoolUnique(vk::QueryPoolCreateInfo{{}, vk::QueryType::eTimestamp, 2});
+      f.cb.resetQueryPool(*f.queryPool, 0, 2);
+      f.cb.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *f.queryPool, 0);
+    }
+    return &f;
+  }
+
+  void endFrame(Frame &f) {
+    if (f.queryPool) {
+      f.cb.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *f.queryPool, 1);
+    }
+    f.cb.end();
+  }
+
+  // Build the object for one record or record its commands. Returns false if the record is bad.
+  bool replay(CaptureOp op, Reader r, Frame &frame) {
+    typedef vk::BufferUsageFlagBits buf;
+    switch (op) {
+      case CaptureOp::buffer: {
+        uint32_t id = r.u32();
+        vk::DeviceSize size = r.u64();
+        if (!r.ok || id != buffers_.size()) return false;
+        // Usage is not recorded, so allow anything a compute trace can do.
+        auto usage = buf::eStorageBuffer|buf::eUniformBuffer|buf::eIndirectBuffer|buf::eVertexBuffer|buf::eIndexBuffer|buf::eTransferSrc|buf::eTransferDst;
+        buffers_.emplace_back(device_, memprops_, usage, size);
+      } break;
+      case CaptureOp::upload: {
+        Upload u;
+        u.buffer = r.u32();
+        u.offset = r.u64();
+        size_t size = (size_t)r.u64();
+        const uint8_t *bytes = r.bytes(size);
+        if (!r.ok || u.buffer >= buffers_.size()) return false;
+        u.bytes.assign(bytes, bytes + size);
+        frame.uploads.push_back(std::move(u));
+      } break;
+      case CaptureOp::kernel: {
+        uint32_t id = r.u32();
+        uint32_t pushConstantSize = r.u32();
+        uint32_t numSpecialization = r.u32();
+        std::vector<uint32_t> specialization;
+        for (uint32_t i = 0; i != numSpecialization && r.ok; ++i) {
+          specialization.push_back(r.u32());
+        }
+        if (!r.ok || id != kernels_.size() || r.p == r.end) return false;
+        ShaderModule shader{device_, r.p, r.end};
+        kernels_.emplace_back(device_, memprops_, queueFamilyIndex_, std::move(shader), pushConstantSize, specialization, 1);
+      } break;
+      case CaptureOp::dispatch: {
+        uint32_t id = r.u32();
+        uint32_t groupsX = r.u32(), groupsY = r.u32(), groupsZ = r.u32();
+        uint32_t numBuffers = r.u32();
+        if (!r.ok || id >= kernels_.size()) return false;
+        ComputeKernel &kernel = kernels_[id];
+        auto &bindings = kernel.bindings();
+        vk::DescriptorSet set = descriptorSets_.allocate(kernel.descriptorSetLayout());
+        DescriptorSetUpdater update;
+        update.beginDescriptorSet(set);
+        for (uint32_t i = 0; i != numBuffers; ++i) {
+          uint32_t b = r.u32();
+          if (!r.ok || b >= buffers_.size() || i >= bindings.size()) return false;
+          update.beginBuffers(bindings[i].binding, 0, bindings[i].descriptorType);
+          update.buffer(buffers_[b].buffer(), 0, VK_WHOLE_SIZE);
+        }
+        update.update(device_);
+        uint32_t pushConstantSize = r.u32();
+        const uint8_t *pushConstants = r.bytes(pushConstantSize);
+        if (!r.ok) return false;
+        kernel.pushConstants(pushConstants, pushConstantSize);
+        kernel.dispatch(frame.cb, set, groupsX, groupsY, groupsZ);
+      } break;
+      case CaptureOp::barrier: {
+        auto srcStageMask = vk::PipelineStageFlags((vk::PipelineStageFlagBits)r.u32());
+        auto dstStageMask = vk::PipelineStageFlags((vk::PipelineStageFlagBits)r.u32());
+        auto srcAccessMask = vk::AccessFlags((vk::AccessFlagBits)r.u32());
+        auto dstAccessMask = vk::AccessFlags((vk::AccessFlagBits)r.u32());
+        if (!r.ok) return false;
+        frame.cb.pipelineBarrier(srcStageMask, dstStageMask, vk::DependencyFlags{}, vk::MemoryBarrier{srcAccessMask, dstAccessMask}, nullptr, nullptr);
+      } break;
+      case CaptureOp::copyBuffer: {
+        uint32_t src = r.u32(), dst = r.u32();
+        vk::BufferCopy region;
+        region.srcOffset = r.u64();
+        region.dstOffset = r.u64();
+        region.size = r.u64();
+        if (!r.ok || src >= buffers_.size() || dst >= buffers_.size()) return false;
+        frame.cb.copyBuffer(buffers_[src].buffer(), buffers_[dst].buffer(), region);
+      } break;
+      case CaptureOp::fillBuffer: {
+        uint32_t dst = r.u32();
+        vk::DeviceSize offset = r.u64();
+        vk::DeviceSize size = r.u64();
+        uint32_t value = r.u32();
+        if (!r.ok || dst >= buffers_.size()) return false;
+        frame.cb.fillBuffer(buffers_[dst].buffer(), offset, size, value);
+      } break;
+      default: {
+        // endFrame, or records from newer versions of Capture.
+      } break;
+    }
+    return true;
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memprops_;
+  uint32_t queueFamilyIndex_ = 0;
+  vk::UniqueCommandPool commandPool_;
+  vk::UniqueFence fence_;
+  DescriptorAllocator descriptorSets_;
+  std::vector<GenericBuffer> buffers_;
+  std::vector<ComputeKernel> kernels_;
+  std::deque<Frame> frames_;
+  double timestampPeriod_ = 0;
+  uint64_t timestampMask_ = 0;
+  bool ok_ = false;
+};
+
+} // namespace vku
+
+#endif // VKU_CAPTURE_HPP
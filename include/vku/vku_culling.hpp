@@ -0,0 +1,624 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU driven culling for the Vookoo high level C++ Vulkan interface.
+//
+// Instances are culled by a compute shader which writes indirect draw
+// commands, so the CPU records one draw call however many instances there are.
+// OcclusionCuller also rejects instances hidden behind the previous frame's
+// depth buffer using a hierarchical-Z pyramid. ClusterCuller culls the
+// clusters of dense meshes (see vku::MeshletBuilder) against the frustum and
+// their normal cones, so back facing and off screen parts are not drawn.
+//
+// The compute shaders are in the shaders/ directory and must be compiled
+// to SPIR-V, eg. as benchmarks/CMakeLists.txt does.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_CULLING_HPP
+#define VKU_CULLING_HPP
+
+#include <vku/vku.hpp>
+
+#include <cmath>
+#include <cstring>
+
+namespace vku {
+
+/// One instance to cull. This matches the Instance struct of frustum_cull.comp.
+struct CullInstance {
+  /// Object to world transform, column major as in glm.
+  float transform[16];
+
+  /// Object space bounding sphere: centre x, y, z and radius.
+  float sphere[4];
+
+  /// Index of the CullMesh to draw.
+  uint32_t mesh;
+  uint32_t pad[3];
+};
+
+/// Where a mesh lives in the shared vertex and index buffers.
+struct CullMesh {
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t pad;
+};
+
+/// One cluster of a mesh's triangles. This matches the Cluster struct of cluster_cull.comp.
+struct CullCluster {
+  /// Object space bounding sphere: centre x, y, z and radius.
+  float sphere[4];
+
+  /// Object space normal cone: axis x, y, z and cutoff, the sine of the cone's half angle.
+  /// The cluster faces away from any viewer v with dot(normalize(v - centre), axis) <= -cutoff.
+  /// A cutoff of 1 or more never culls.
+  float cone[4];
+
+  /// The cluster's triangles as a range of the mesh's index buffer.
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t pad;
+};
+
+/// The clusters of one mesh, a range of the cluster table.
+struct ClusterMesh {
+  uint32_t firstCluster;
+  uint32_t clusterCount;
+  uint32_t pad[2];
+};
+
+/// Extract the six normalised frustum planes (x, y, z, w with xyz.p + w >= 0 inside)
+/// from a column major view projection matrix with Vulkan's 0..1 depth range.
+inline void frustumPlanes(const float viewProjection[16], float planes[24]) {
+  auto m = [viewProjection](int row, int col) { return viewProjection[col * 4 + row]; };
+  for (int i = 0; i != 4; ++i) {
+    planes[0 * 4 + i] = m(3, i) + m(0, i); // left
+    planes[1 * 4 + i] = m(3, i) - m(0, i); // right
+    planes[2 * 4 + i] = m(3, i) + m(1, i); // bottom
+    planes[3 * 4 + i] = m(3, i) - m(1, i); // top
+    planes[4 * 4 + i] = m(2, i);           // near
+    planes[5 * 4 + i] = m(3, i) - m(2, i); // far
+  }
+  for (int p = 0; p != 6; ++p) {
+    float *pl = planes + p * 4;
+    float len = std::sqrt(pl[0] * pl[0] + pl[1] * pl[1] + pl[2] * pl[2]);
+    if (len > 0) {
+      for (int i = 0; i != 4; ++i) pl[i] /= len;
+    }
+  }
+}
+
+/// The instance, mesh and draw command buffers shared by the cullers, and the indirect draw
+/// of the commands written by their cull(). Each culler records its own shader with its own
+/// bindings and push constants, so cull() and beginFrame() are not part of this class.
+class IndirectCuller {
+public:
+  /// Upload the instances (at most maxInstances). This stalls, for moving objects
+  /// write instances() from a compute shader or a transfer instead.
+  void uploadInstances(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<CullInstance> &instances) {
+    s.numInstances = (uint32_t)std::min(instances.size(), (size_t)s.maxInstances);
+    s.instances.upload(device, memprops, commandPool, queue, instances.data(), s.numInstances * sizeof(CullInstance));
+    updateNumDraws();
+  }
+
+  /// Set the number of instances to cull when instances() is written on the GPU.
+  void numInstances(uint32_t value) {
+    s.numInstances = std::min(value, s.maxInstances);
+    updateNumDraws();
+  }
+
+  /// Draw the visible instances with the currently bound pipeline, vertex and index buffers.
+  void draw(vk::CommandBuffer cb) const {
+    uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    if (s.vkCmdDrawIndexedIndirectCountKHR) {
+      s.vkCmdDrawIndexedIndirectCountKHR(cb, s.draws.buffer(), 0, s.count.buffer(), 0, s.maxDraws, stride);
+    } else if (s.numDraws) {
+      cb.drawIndexedIndirect(s.draws.buffer(), 0, s.numDraws, stride);
+    }
+  }
+
+  /// The instance buffer, for the vertex shader to read transforms from.
+  const GenericBuffer &instances() const { return s.instances; }
+
+  /// The compacted draw commands.
+  const GenericBuffer &draws() const { return s.draws; }
+
+  /// The number of visible instances as a single uint32_t.
+  const GenericBuffer &count() const { return s.count; }
+
+  /// Returns true if draw() uses vkCmdDrawIndexedIndirectCountKHR.
+  bool drawIndirectCount() const { return s.vkCmdDrawIndexedIndirectCountKHR != nullptr; }
+
+protected:
+  IndirectCuller() {
+  }
+
+  // maxDraws defaults to one draw per instance.
+  void createBuffers(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t maxInstances, bool drawIndirectCount, uint32_t maxDraws = 0) {
+    s.maxInstances = maxInstances;
+    s.maxDraws = maxDraws ? maxDraws : maxInstances;
+    if (drawIndirectCount) {
+      s.vkCmdDrawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)device.getProcAddr("vkCmdDrawIndexedIndirectCountKHR");
+    }
+
+    typedef vk::BufferUsageFlagBits buf;
+    s.instances = GenericBuffer(device, memprops, buf::eStorageBuffer|buf::eTransferDst, std::max(maxInstances, 1u) * sizeof(CullInstance));
+    s.draws = GenericBuffer(device, memprops, buf::eStorageBuffer|buf::eIndirectBuffer|buf::eTransferDst, std::max(s.maxDraws, 1u) * sizeof(vk::DrawIndexedIndirectCommand));
+    s.count = GenericBuffer(device, memprops, buf::eStorageBuffer|buf::eIndirectBuffer|buf::eTransferDst|buf::eTransferSrc, sizeof(uint32_t));
+  }
+
+  // Upload a table of CullMesh or ClusterMesh, growing the buffer if needed.
+  template <class Mesh>
+  void uploadMeshTable(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<Mesh> &meshes) {
+    typedef vk::BufferUsageFlagBits buf;
+    vk::DeviceSize size = std::max(meshes.size(), (size_t)1) * sizeof(Mesh);
+    if (!s.meshes.buffer() || s.meshes.size() < size) {
+      s.meshes = GenericBuffer(device, memprops, buf::eStorageBuffer|buf::eTransferDst, size);
+    }
+    s.meshes.upload(device, memprops, commandPool, queue, meshes);
+  }
+
+  // The most draws one instance can make, one unless it is drawn in clusters.
+  void drawsPerInstance(uint32_t value) {
+    s.drawsPerInstance = value;
+    updateNumDraws();
+  }
+
+  // Reset the count, and the commands if draw() has to issue all of them, before the cull shader appends to them.
+  // There is one set of draw buffers, so the fills wait for the last frame's draw() to read them.
+  void resetDraws(vk::CommandBuffer cb) {
+    typedef vk::PipelineStageFlagBits psflags;
+    typedef vk::AccessFlagBits aflags;
+    vk::MemoryBarrier drawn{aflags::eIndirectCommandRead, aflags::eTransferWrite};
+    cb.pipelineBarrier(psflags::eDrawIndirect, psflags::eTransfer, {}, drawn, nullptr, nullptr);
+    cb.fillBuffer(s.count.buffer(), 0, sizeof(uint32_t), 0);
+    if (!s.vkCmdDrawIndexedIndirectCountKHR && s.numDraws) {
+      cb.fillBuffer(s.draws.buffer(), 0, s.numDraws * sizeof(vk::DrawIndexedIndirectCommand), 0);
+    }
+    vk::MemoryBarrier clear{aflags::eTransferWrite, aflags::eShaderRead|aflags::eShaderWrite|aflags::eUniformRead};
+    cb.pipelineBarrier(psflags::eTransfer, psflags::eComputeShader, {}, clear, nullptr, nullptr);
+    VKU_COUNT(barriers, 2);
+  }
+
+  // Make the cull shader's output visible to draw().
+  static void drawsWritten(vk::CommandBuffer cb) {
+    typedef vk::PipelineStageFlagBits psflags;
+    typedef vk::AccessFlagBits aflags;
+    vk::MemoryBarrier written{aflags::eShaderWrite, aflags::eIndirectCommandRead|aflags::eShaderRead};
+    cb.pipelineBarrier(psflags::eComputeShader, psflags::eDrawIndirect|psflags::eVertexShader, {}, written, nullptr, nullptr);
+    VKU_COUNT(barriers, 1);
+  }
+
+  struct State {
+    GenericBuffer instances;
+    GenericBuffer meshes;
+    GenericBuffer draws;
+    GenericBuffer count;
+    PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCountKHR = nullptr;
+    uint32_t maxInstances = 0;
+    uint32_t numInstances = 0;
+
+    // Draw slots: the size of draws() and the number draw() issues without a count buffer.
+    uint32_t maxDraws = 0;
+    uint32_t numDraws = 0;
+    uint32_t drawsPerInstance = 1;
+  };
+
+  State s;
+
+private:
+  void updateNumDraws() {
+    s.numDraws = (uint32_t)std::min((uint64_t)s.numInstances * s.drawsPerInstance, (uint64_t)s.maxDraws);
+  }
+};
+
+/// Frustum cull instances on the GPU and draw the survivors with one indirect call.
+/// example:
+///     vku::FrustumCuller culler{device, memprops, queueFamilyIndex, BINARY_DIR, 100000, fw.drawIndirectCount()};
+///     culler.uploadMeshes(device, memprops, commandPool, queue, meshes);
+///     culler.uploadInstances(device, memprops, commandPool, queue, instances);
+///
+///     // Outside the render pass:
+///     culler.cull(cb, &viewProjection[0][0]);
+///     cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
+///     cb.bindPipeline(...); cb.bindVertexBuffers(...); cb.bindIndexBuffer(...);
+///     culler.draw(cb);
+///
+/// The vertex shader reads its transform with gl_InstanceIndex from instances(), which
+/// needs the drawIndirectFirstInstance feature; more than one draw needs multiDrawIndirect.
+/// Without VK_KHR_draw_indirect_count, draw() issues one (possibly empty) command per instance.
+class FrustumCuller : public IndirectCuller {
+public:
+  FrustumCuller() {
+  }
+
+  FrustumCuller(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, const std::string &shaderDir, uint32_t maxInstances, bool drawIndirectCount = false, uint32_t workgroupSize = 64, int framesInFlight = 2) {
+    createBuffers(device, memprops, maxInstances, drawIndirectCount);
+    ShaderModule shader{device, shaderDir + "frustum_cull.comp.spv"};
+    kernel_ = ComputeKernel(device, memprops, queueFamilyIndex, std::move(shader), sizeof(PushConstants), {workgroupSize}, framesInFlight);
+  }
+
+  /// Upload the mesh table. Instances refer to meshes by index.
+  void uploadMeshes(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<CullMesh> &meshes) {
+    uploadMeshTable(device, memprops, commandPool, queue, meshes);
+  }
+
+  /// Record the culling dispatch. Call outside a render pass, before draw().
+  void cull(vk::CommandBuffer cb, const float viewProjection[16]) {
+    resetDraws(cb);
+
+    PushConstants pc;
+    frustumPlanes(viewProjection, pc.planes);
+    pc.numInstances = s.numInstances;
+    kernel_.pushConstants(pc);
+    kernel_.dispatch(cb, std::max(kernel_.groupsFor(s.numInstances), 1u), 1, 1, s.instances, s.meshes, s.draws, s.count);
+
+    drawsWritten(cb);
+  }
+
+  /// Release the descriptor sets of a frame's cull() once the GPU has finished with them.
+  void beginFrame(int frameIndex) { kernel_.beginFrame(frameIndex); }
+
+private:
+  struct PushConstants {
+    float planes[24];
+    uint32_t numInstances;
+  };
+
+  ComputeKernel kernel_;
+};
+
+/// Frustum and hierarchical-Z occlusion culling.
+/// After rendering, buildPyramid() reduces the depth buffer to a mip pyramid of farthest depths.
+/// On the next frame cull() also rejects instances whose bounds are behind that pyramid as
+/// seen from the camera that rendered it. Drawing is the same as for FrustumCuller.
+/// example:
+///     vku::OcclusionCuller culler{device, memprops, queueFamilyIndex, BINARY_DIR, 100000, window.width(), window.height(), fw.drawIndirectCount()};
+///
+///     // Each frame, outside the render pass:
+///     culler.cull(cb, &viewProjection[0][0]);
+///     cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
+///     culler.draw(cb);
+///     cb.endRenderPass();
+///     culler.buildPyramid(cb, window.depthStencilImage(), &viewProjection[0][0]);
+///
+/// Depth must be cleared to 1 and tested with eLess or eLessOrEqual.
+/// An object uncovered by a moving occluder may be missing for a frame. Call
+/// invalidatePyramid() after a camera cut to draw everything in the frustum.
+class OcclusionCuller : public IndirectCuller {
+public:
+  OcclusionCuller() {
+  }
+
+  OcclusionCuller(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, const std::string &shaderDir, uint32_t maxInstances, uint32_t width, uint32_t height, bool drawIndirectCount = false, uint32_t workgroupSize = 64, int framesInFlight = 2) {
+    createBuffers(device, memprops, maxInstances, drawIndirectCount);
+    hiz.device = device;
+    hiz.memprops = memprops;
+
+    ShaderModule reduce{device, shaderDir + "hiz_reduce.comp.spv"};
+    hiz.reduce = ComputeKernel(device, memprops, queueFamilyIndex, std::move(reduce), sizeof(ReduceConstants), {reduceTile, reduceTile}, framesInFlight);
+
+    ShaderModule cull{device, shaderDir + "hiz_cull.comp.spv"};
+    hiz.cull = ComputeKernel(device, memprops, queueFamilyIndex, std::move(cull), 0, {workgroupSize}, framesInFlight);
+
+    hiz.params = GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eUniformBuffer|vk::BufferUsageFlagBits::eTransferDst, sizeof(Params));
+    hiz.sampler = SamplerMaker{}.createUnique(device);
+    resize(width, height);
+  }
+
+  /// Upload the mesh table. Instances refer to meshes by index.
+  void uploadMeshes(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<CullMesh> &meshes) {
+    uploadMeshTable(device, memprops, commandPool, queue, meshes);
+  }
+
+  /// Record the culling dispatch against the last pyramid. Call outside a render pass, before draw().
+  void cull(vk::CommandBuffer cb, const float viewProjection[16]) {
+    typedef vk::PipelineStageFlagBits psflags;
+    if (!hiz.pyramidLayout) {
+      // Nothing has been built yet, but the sampler still needs a valid layout.
+      pyramidBarrier(cb, vk::ImageLayout::eUndefined, psflags::eTopOfPipe, {}, psflags::eComputeShader, vk::AccessFlagBits::eShaderRead, 0, hiz.numLevels);
+      hiz.pyramidLayout = true;
+    }
+
+    Params params;
+    frustumPlanes(viewProjection, params.planes);
+    memcpy(params.pyramidViewProjection, hiz.viewProjection, sizeof(params.pyramidViewProjection));
+    params.pyramidSize[0] = (float)hiz.width;
+    params.pyramidSize[1] = (float)hiz.height;
+    params.numInstances = s.numInstances;
+    params.numLevels = hiz.valid ? hiz.numLevels : 0;
+
+    // Wait for the last cull to read the parameters before overwriting them.
+    cb.pipelineBarrier(psflags::eComputeShader, psflags::eTransfer, {}, nullptr, nullptr, nullptr);
+    VKU_COUNT(barriers, 1);
+    cb.updateBuffer(hiz.params.buffer(), 0, sizeof(params), &params);
+    resetDraws(cb);
+
+    vk::DescriptorSet set = hiz.cull.allocateDescriptorSet();
+    auto &update = hiz.update;
+    update.clear();
+    update.beginDescriptorSet(set);
+    const GenericBuffer *buffers[] = {&s.instances, &s.meshes, &s.draws, &s.count};
+    for (uint32_t binding = 0; binding != 4; ++binding) {
+      update.beginBuffers(binding, 0, vk::DescriptorType::eStorageBuffer);
+      update.buffer(buffers[binding]->buffer(), 0, VK_WHOLE_SIZE);
+    }
+    update.beginBuffers(4, 0, vk::DescriptorType::eUniformBuffer);
+    update.buffer(hiz.params.buffer(), 0, sizeof(Params));
+    update.beginImages(5, 0, vk::DescriptorType::eCombinedImageSampler);
+    update.image(*hiz.sampler, hiz.pyramid.imageView(), vk::ImageLayout::eGeneral);
+    update.update(hiz.device);
+
+    hiz.cull.dispatch(cb, set, std::max(hiz.cull.groupsFor(s.numInstances), 1u), 1, 1);
+    drawsWritten(cb);
+  }
+
+  /// Record the reduction of a depth buffer to the pyramid used by the next cull().
+  /// Call after the render pass; depth is expected to be in eDepthStencilAttachmentOptimal
+  /// and is returned to it, after the reads, for the next frame's clear and depth tests.
+  /// viewProjection is the matrix depth was rendered with.
+  void buildPyramid(vk::CommandBuffer cb, GenericImage &depth, const float viewProjection[16]) {
+    typedef vk::PipelineStageFlagBits psflags;
+    typedef vk::AccessFlagBits aflags;
+    auto extent = depth.extent();
+    if (extent.width != hiz.width || extent.height != hiz.height) {
+      resize(extent.width, extent.height);
+    }
+
+    // Finish the depth writes and the last cull's reads of the pyramid.
+    typedef vk::ImageAspectFlagBits iafb;
+    auto format = depth.format();
+    bool stencil = format == vk::Format::eD16UnormS8Uint || format == vk::Format::eD24UnormS8Uint || format == vk::Format::eD32SfloatS8Uint;
+    vk::ImageMemoryBarrier depthBarrier{
+      aflags::eDepthStencilAttachmentWrite, aflags::eShaderRead,
+      vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageLayout::eDepthStencilReadOnlyOptimal,
+      VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, depth.image(),
+      {stencil ? iafb::eDepth|iafb::eStencil : iafb::eDepth, 0, 1, 0, 1}
+    };
+    cb.pipelineBarrier(psflags::eEarlyFragmentTests|psflags::eLateFragmentTests, psflags::eComputeShader, {}, nullptr, nullptr, depthBarrier);
+    VKU_COUNT(barriers, 1);
+    depth.setCurrentLayout(vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+
+    vk::ImageLayout oldLayout = hiz.pyramidLayout ? vk::ImageLayout::eGeneral : vk::ImageLayout::eUndefined;
+    pyramidBarrier(cb, oldLayout, psflags::eComputeShader, aflags::eShaderRead, psflags::eComputeShader, aflags::eShaderWrite, 0, hiz.numLevels);
+    hiz.pyramidLayout = true;
+
+    for (uint32_t level = 0; level != hiz.numLevels; ++level) {
+      ReduceConstants rc;
+      rc.srcSize[0] = level ? mipScale(hiz.width, level - 1) : extent.width;
+      rc.srcSize[1] = level ? mipScale(hiz.height, level - 1) : extent.height;
+      rc.dstSize[0] = mipScale(hiz.width, level);
+      rc.dstSize[1] = mipScale(hiz.height, level);
+
+      vk::DescriptorSet set = hiz.reduce.allocateDescriptorSet();
+      auto &update = hiz.update;
+      update.clear();
+      update.beginDescriptorSet(set);
+      update.beginImages(0, 0, vk::DescriptorType::eCombinedImageSampler);
+      if (level) {
+        update.image(*hiz.sampler, *hiz.levelViews[level - 1], vk::ImageLayout::eGeneral);
+      } else {
+        update.image(*hiz.sampler, depth.imageView(), vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+      }
+      update.beginImages(1, 0, vk::DescriptorType::eStorageImage);
+      update.image(vk::Sampler{}, *hiz.levelViews[level], vk::ImageLayout::eGeneral);
+      update.update(hiz.device);
+
+      hiz.reduce.pushConstants(rc);
+      hiz.reduce.dispatch(cb, set, (rc.dstSize[0] + reduceTile - 1) / reduceTile, (rc.dstSize[1] + reduceTile - 1) / reduceTile, 1);
+
+      // This level is the source of the next one, and of cull().
+      pyramidBarrier(cb, vk::ImageLayout::eGeneral, psflags::eComputeShader, aflags::eShaderWrite, psflags::eComputeShader, aflags::eShaderRead, level, 1);
+    }
+
+    // The render pass only orders colour output, so the next frame's depth clear and
+    // layout transition must wait here for the reads above.
+    std::swap(depthBarrier.oldLayout, depthBarrier.newLayout);
+    depthBarrier.srcAccessMask = aflags::eShaderRead;
+    depthBarrier.dstAccessMask = aflags::eDepthStencilAttachmentRead|aflags::eDepthStencilAttachmentWrite;
+    cb.pipelineBarrier(psflags::eComputeShader, psflags::eEarlyFragmentTests|psflags::eLateFragmentTests, {}, nullptr, nullptr, depthBarrier);
+    VKU_COUNT(barriers, 1);
+    depth.setCurrentLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    memcpy(hiz.viewProjection, viewProjection, sizeof(hiz.viewProjection));
+    hiz.valid = true;
+  }
+
+  /// Stop occlusion culling until the next buildPyramid(), eg. after a camera cut.
+  void invalidatePyramid() { hiz.valid = false; }
+
+  /// Recreate the pyramid for a new depth buffer size. buildPyramid() does this when the size changes.
+  void resize(uint32_t width, uint32_t height) {
+    if (hiz.pyramid.image()) {
+      hiz.retired.push_back(std::move(hiz.pyramid));
+    }
+    for (auto &v : hiz.levelViews) hiz.retiredViews.push_back(std::move(v));
+    hiz.levelViews.clear();
+
+    hiz.width = std::max(width, 1u);
+    hiz.height = std::max(height, 1u);
+    hiz.numLevels = 1;
+    while ((std::max(hiz.width, hiz.height) >> hiz.numLevels) != 0) ++hiz.numLevels;
+
+    vk::ImageCreateInfo info;
+    info.imageType = vk::ImageType::e2D;
+    info.format = vk::Format::eR32Sfloat;
+    info.extent = vk::Extent3D{hiz.width, hiz.height, 1U};
+    info.mipLevels = hiz.numLevels;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    info.initialLayout = vk::ImageLayout::eUndefined;
+    hiz.pyramid = GenericImage(hiz.device, hiz.memprops, info, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, false);
+
+    for (uint32_t level = 0; level != hiz.numLevels; ++level) {
+      vk::ImageViewCreateInfo viewInfo{};
+      viewInfo.image = hiz.pyramid.image();
+      viewInfo.viewType = vk::ImageViewType::e2D;
+      viewInfo.format = info.format;
+      viewInfo.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, level, 1, 0, 1};
+      hiz.levelViews.push_back(hiz.device.createImageViewUnique(viewInfo));
+    }
+
+    hiz.pyramidLayout = false;
+    hiz.valid = false;
+  }
+
+  /// Release the descriptor sets of a frame's commands, and any pyramids replaced by resize(),
+  /// once the GPU has finished with them.
+  void beginFrame(int frameIndex) {
+    hiz.reduce.beginFrame(frameIndex);
+    hiz.cull.beginFrame(frameIndex);
+    hiz.retired.clear();
+    hiz.retiredViews.clear();
+  }
+
+  /// The depth pyramid, R32 with a full mip chain in eGeneral layout.
+  const GenericImage &pyramid() const { return hiz.pyramid; }
+
+private:
+  enum { reduceTile = 8 };
+
+  struct ReduceConstants {
+    int32_t srcSize[2];
+    int32_t dstSize[2];
+  };
+
+  // Matches the std140 Params block of hiz_cull.comp.
+  struct Params {
+    float planes[24];
+    float pyramidViewProjection[16];
+    float pyramidSize[2];
+    uint32_t numInstances;
+    uint32_t numLevels;
+  };
+
+  void pyramidBarrier(vk::CommandBuffer cb, vk::ImageLayout oldLayout, vk::PipelineStageFlags srcStage, vk::AccessFlags srcAccess, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess, uint32_t baseLevel, uint32_t numLevels) {
+    vk::ImageMemoryBarrier barrier{
+      srcAccess, dstAccess, oldLayout, vk::ImageLayout::eGeneral,
+      VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, hiz.pyramid.image(),
+      {vk::ImageAspectFlagBits::eColor, baseLevel, numLevels, 0, 1}
+    };
+    cb.pipelineBarrier(srcStage, dstStage, {}, nullptr, nullptr, barrier);
+    VKU_COUNT(barriers, 1);
+  }
+
+  struct HiZState {
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memprops;
+    ComputeKernel reduce;
+    ComputeKernel cull;
+    GenericBuffer params;
+    vk::UniqueSampler sampler;
+    GenericImage pyramid;
+    std::vector<vk::UniqueImageView> levelViews;
+    std::vector<GenericImage> retired;
+    std::vector<vk::UniqueImageView> retiredViews;
+    DescriptorSetUpdater update{6, 2};
+    float viewProjection[16] = {};
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t numLevels = 0;
+    bool pyramidLayout = false;
+    bool valid = false;
+  };
+
+  HiZState hiz;
+};
+
+/// Frustum and back face cone culling of mesh clusters, drawing each visible cluster.
+/// Instances are CullInstances whose mesh indexes a table of ClusterMeshes, each a range
+/// of the CullCluster table.
+/// example:
+///     std::vector<vku::CullCluster> clusters = vku::MeshletBuilder{}.build(mesh);
+///     vku::ClusterCuller culler{device, memprops, queueFamilyIndex, BINARY_DIR, 1000, 100000, fw.drawIndirectCount()};
+///     culler.uploadClusters(device, memprops, commandPool, queue, clusters);
+///     culler.uploadMeshes(device, memprops, commandPool, queue, {vku::ClusterMesh{0, (uint32_t)clusters.size()}});
+///     culler.uploadInstances(device, memprops, commandPool, queue, instances);
+///
+///     // Outside the render pass:
+///     culler.cull(cb, &viewProjection[0][0], &cameraPos[0]);
+///     cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
+///     culler.draw(cb);
+///
+/// Cones use the triangles' cross(p1 - p0, p2 - p0) normals, so the pipeline must cull
+/// the faces those point away from. Instance transforms may only scale uniformly.
+/// Drawing is otherwise the same as for FrustumCuller.
+class ClusterCuller : public IndirectCuller {
+public:
+  ClusterCuller() {
+  }
+
+  /// Each instance's clusters are culled by one row of workgroups, so there can be at most 65535 instances.
+  ClusterCuller(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, const std::string &shaderDir, uint32_t maxInstances, uint32_t maxDraws, bool drawIndirectCount = false, uint32_t workgroupSize = 64, int framesInFlight = 2) {
+    createBuffers(device, memprops, maxInstances, drawIndirectCount, maxDraws);
+    drawsPerInstance(0);
+    ShaderModule shader{device, shaderDir + "cluster_cull.comp.spv"};
+    cl.kernel = ComputeKernel(device, memprops, queueFamilyIndex, std::move(shader), sizeof(PushConstants), {workgroupSize}, framesInFlight);
+  }
+
+  /// Upload the cluster table. ClusterMeshes refer to ranges of it.
+  void uploadClusters(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<CullCluster> &clusters) {
+    typedef vk::BufferUsageFlagBits buf;
+    vk::DeviceSize size = std::max(clusters.size(), (size_t)1) * sizeof(CullCluster);
+    if (!cl.clusters.buffer() || cl.clusters.size() < size) {
+      cl.clusters = GenericBuffer(device, memprops, buf::eStorageBuffer|buf::eTransferDst, size);
+    }
+    cl.clusters.upload(device, memprops, commandPool, queue, clusters);
+  }
+
+  /// Upload the mesh table. Instances refer to meshes by index.
+  void uploadMeshes(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<ClusterMesh> &meshes) {
+    uploadMeshTable(device, memprops, commandPool, queue, meshes);
+    cl.maxClusters = 0;
+    for (auto &m : meshes) cl.maxClusters = std::max(cl.maxClusters, m.clusterCount);
+
+    // Every cluster of every instance may be visible.
+    drawsPerInstance(cl.maxClusters);
+  }
+
+  /// Record the culling dispatch. Call outside a render pass, before draw().
+  /// cameraPos is the world space eye position for the cone tests.
+  void cull(vk::CommandBuffer cb, const float viewProjection[16], const float cameraPos[3]) {
+    resetDraws(cb);
+
+    PushConstants pc;
+    frustumPlanes(viewProjection, pc.planes);
+    for (int i = 0; i != 3; ++i) pc.cameraPos[i] = cameraPos[i];
+    pc.cameraPos[3] = 1;
+    pc.numInstances = s.numInstances;
+    pc.maxDraws = s.maxDraws;
+    cl.kernel.pushConstants(pc);
+    uint32_t groupsX = std::max(cl.kernel.groupsFor(cl.maxClusters), 1u);
+    cl.kernel.dispatch(cb, groupsX, std::max(s.numInstances, 1u), 1, s.instances, s.meshes, cl.clusters, s.draws, s.count);
+
+    drawsWritten(cb);
+  }
+
+  /// Release the descriptor sets of a frame's cull() once the GPU has finished with them.
+  void beginFrame(int frameIndex) { cl.kernel.beginFrame(frameIndex); }
+
+private:
+  struct PushConstants {
+    float planes[24];
+    float cameraPos[4];
+    uint32_t numInstances;
+    uint32_t maxDraws;
+  };
+
+  struct ClusterState {
+    ComputeKernel kernel;
+    GenericBuffer clusters;
+    uint32_t maxClusters = 0;
+  };
+
+  ClusterState cl;
+};
+
+} // namespace vku
+
+#endif // VKU_CULLING_HPP
@@ -43,12 +43,144 @@
 #include <chrono>
 #include <functional>
 #include <cstddef>
+#include <cstring>
 
 #include <vulkan/vulkan.hpp>
 #include <vku/vku.hpp>
 
 namespace vku {
 
+/// Options for building a Framework: layers, debug reporting, extensions, features
+/// and the choice of physical device.
+/// Validation is on by default, and off when NDEBUG is defined so that release builds
+/// load no layers and install no debug callback.
+/// example:
+///     vku::FrameworkMaker fm{};
+///     fm.validation(false);
+///     fm.deviceExtension(VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME, false);
+///     vk::PhysicalDeviceFeatures features{};
+///     features.samplerAnisotropy = VK_TRUE;
+///     fm.requireFeatures(features);
+///     vku::Framework fw{"app", fm};
+///     bool conservative = fw.hasDeviceExtension(VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME);
+class FrameworkMaker {
+public:
+  FrameworkMaker() {
+    // The features reported by Framework::multiDrawIndirect() and pipelineStatisticsQuery().
+    s.optionalFeatures.multiDrawIndirect = VK_TRUE;
+    s.optionalFeatures.drawIndirectFirstInstance = VK_TRUE;
+    s.optionalFeatures.pipelineStatisticsQuery = VK_TRUE;
+    s.optionalFeatures.occlusionQueryPrecise = VK_TRUE;
+  }
+
+  /// Use VK_LAYER_LUNARG_standard_validation with a debug report callback.
+  /// If the layer is not installed the Framework is built without it.
+  void validation(bool value) {
+    s.validation = value;
+  }
+
+  /// Add an instance and device layer. Missing optional layers are skipped.
+  void layer(const char *name, bool required = true) {
+    s.layers.emplace_back(name, required);
+  }
+
+  /// Report these message types, with or without validation.
+  /// The default callback prints to stdout. Empty flags turn reporting off.
+  void debugReport(vk::DebugReportFlagsEXT flags, PFN_vkDebugReportCallbackEXT callback = nullptr) {
+    s.debugReport = true;
+    s.debugFlags = flags;
+    s.debugCallback = callback;
+  }
+
+  /// Enable the surface and swapchain extensions needed by vku::Window (the default).
+  /// Turn this off for compute or offscreen work.
+  void surface(bool value) {
+    s.surface = value;
+  }
+
+  /// Add an instance extension. Missing optional extensions are skipped.
+  void instanceExtension(const char *name, bool required = true) {
+    s.instanceExtensions.emplace_back(name, required);
+  }
+
+  /// Add a device extension. Devices without a required extension are not considered.
+  /// Use Framework::hasDeviceExtension() to see if an optional one was enabled.
+  void deviceExtension(const char *name, bool required = true) {
+    s.deviceExtensions.emplace_back(name, required);
+  }
+
+  /// Add features the device must have. Devices without them are not considered.
+  void requireFeatures(const vk::PhysicalDeviceFeatures &value) {
+    merge(s.requiredFeatures, value);
+  }
+
+  /// Add features to enable if the device has them. See Framework::enabledFeatures().
+  void optionalFeatures(const vk::PhysicalDeviceFeatures &value) {
+    merge(s.optionalFeatures, value);
+  }
+
+  /// Set the Vulkan version to ask for. 1.1 is used only if the loader has it.
+  void apiVersion(uint32_t value) {
+    s.apiVersion = value;
+  }
+
+  /// Set the priorities passed to vkCreateDevice for the graphics and compute queues.
+  void queuePriorities(float graphics, float compute) {
+    s.graphicsQueuePriority = graphics;
+    s.computeQueuePriority = compute;
+  }
+
+  /// Build a device level dispatch table after creating the device, see Framework::dispatch().
+  void deviceDispatch(bool value) {
+    s.deviceDispatch = value;
+  }
+
+  /// Use enumeratePhysicalDevices()[index] instead of ranking the devices.
+  void physicalDevice(uint32_t index) {
+    s.physicalDeviceIndex = (int)index;
+  }
+
+private:
+  static void merge(vk::PhysicalDeviceFeatures &dst, const vk::PhysicalDeviceFeatures &src) {
+    auto to = reinterpret_cast<VkBool32 *>(&dst);
+    auto from = reinterpret_cast<const VkBool32 *>(&src);
+    for (size_t i = 0; i != sizeof(dst) / sizeof(VkBool32); ++i) {
+      if (from[i]) to[i] = VK_TRUE;
+    }
+  }
+
+  typedef std::vector<std::pair<std::string, bool> > Names;
+
+  struct State {
+#ifdef NDEBUG
+    bool validation = false;
+#else
+    bool validation = true;
+#endif
+    bool debugReport = false;
+    vk::DebugReportFlagsEXT debugFlags =
+        vk::DebugReportFlagBitsEXT::eWarning |
+        vk::DebugReportFlagBitsEXT::ePerformanceWarning |
+        vk::DebugReportFlagBitsEXT::eError;
+    PFN_vkDebugReportCallbackEXT debugCallback = nullptr;
+    bool surface = true;
+    Names layers;
+    Names instanceExtensions;
+    Names deviceExtensions;
+    vk::PhysicalDeviceFeatures requiredFeatures;
+    vk::PhysicalDeviceFeatures optionalFeatures;
+    uint32_t apiVersion = VK_API_VERSION_1_1;
+    float graphicsQueuePriority = 1.0f;
+    float computeQueuePriority = 1.0f;
+    int physicalDeviceIndex = -1;
+    bool deviceDispatch = false;
+  };
+
+  State s;
+
+  friend class Framework;
+};
+
 /// This class provides an optional interface to the vulkan instance, devices and queues.
 /// It is not used by any of the other classes directly and so can be safely ignored if Vookoo
 /// is embedded in an engine.
@@ -59,42 +191,100 @@ public:
   }
 
   // Construct a framework containing the instance, a device and one or more queues.
-  Framework(const std::string &name) {
+  // If the device allows, compute gets its own queue so that it can overlap rendering.
+  // The priorities are passed to vkCreateDevice for the graphics and compute queues.
+  Framework(const std::string &name, float graphicsQueuePriority = 1.0f, float computeQueuePriority = 1.0f) {
+    FrameworkMaker fm{};
+    fm.queuePriorities(graphicsQueuePriority, computeQueuePriority);
+    init(name, fm);
+  }
+
+  /// Construct a framework with the layers, extensions, features and device choice of a FrameworkMaker.
+  Framework(const std::string &name, const FrameworkMaker &fm) {
+    init(name, fm);
+  }
+
+  Framework(Framework &&rhs) = default;
+
+  void init(const std::string &name, const FrameworkMaker &fm) {
+    auto &ms = fm.s;
+
+    // Layers, skipping optional ones that are not installed.
+    auto layerProps = vk::enumerateInstanceLayerProperties();
+    FrameworkMaker::Names wantedLayers = ms.layers;
+    if (ms.validation) wantedLayers.emplace_back("VK_LAYER_LUNARG_standard_validation", false);
     std::vector<const char *> layers;
-    layers.push_back("VK_LAYER_LUNARG_standard_validation");
+    bool found = selectNames(layers, wantedLayers, "layer", [&layerProps](const char *name) {
+      for (auto &lp : layerProps) {
+        if (!strcmp(lp.layerName, name)) return true;
+      }
+      return false;
+    });
+    if (!found) return;
+
+    // Instance extensions come from the loader or the layers.
+    auto extensionProps = vk::enumerateInstanceExtensionProperties();
+    for (auto layer : layers) {
+      auto lep = vk::enumerateInstanceExtensionProperties(std::string(layer));
+      extensionProps.insert(extensionProps.end(), lep.begin(), lep.end());
+    }
 
+    bool debugReport = (ms.validation || ms.debugReport) && ms.debugFlags;
+    FrameworkMaker::Names wantedExtensions = ms.instanceExtensions;
+    if (debugReport) wantedExtensions.emplace_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, false);
+    if (ms.surface) {
+      wantedExtensions.emplace_back(VKU_SURFACE, true);
+      wantedExtensions.emplace_back(VK_KHR_SURFACE_EXTENSION_NAME, true);
+    }
     std::vector<const char *> instance_extensions;
-    instance_extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-    instance_extensions.push_back(VKU_SURFACE);
-    instance_extensions.push_back("VK_KHR_surface");
+    found = selectNames(instance_extensions, wantedExtensions, "instance extension", [&extensionProps](const char *name) {
+      return hasExtension(extensionProps, name);
+    });
+    if (!found) return;
 
+    // Ask for Vulkan 1.1 (eg. descriptor update templates) if the loader has it.
     auto appinfo = vk::ApplicationInfo{};
+    appinfo.pApplicationName = name.c_str();
+    if (ms.apiVersion < VK_API_VERSION_1_1 || vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion")) {
+      appinfo.apiVersion = ms.apiVersion;
+    }
     instance_ = vk::createInstanceUnique(vk::InstanceCreateInfo{
         {}, &appinfo, (uint32_t)layers.size(),
         layers.data(), (uint32_t)instance_extensions.size(),
         instance_extensions.data()});
 
-    auto ci = vk::DebugReportCallbackCreateInfoEXT{
-        //vk::DebugReportFlagBitsEXT::eInformation |
-        vk::DebugReportFlagBitsEXT::eWarning |
-        vk::DebugReportFlagBitsEXT::ePerformanceWarning |
-        vk::DebugReportFlagBitsEXT::eError,
-        //vk::DebugReportFlagBitsEXT::eDebug,
-        &debugCallback};
-    const VkDebugReportCallbackCreateInfoEXT &cir = ci;
-
     auto vkCreateDebugReportCallbackEXT =
         (PFN_vkCreateDebugReportCallbackEXT)instance_->getProcAddr(
             "vkCreateDebugReportCallbackEXT");
 
-    VkDebugReportCallbackEXT cb;
-    vkCreateDebugReportCallbackEXT(
-        *instance_, &(const VkDebugReportCallbackCreateInfoEXT &)ci,
-        nullptr, &cb);
-    callback_ = cb;
+    if (debugReport && vkCreateDebugReportCallbackEXT) {
+      auto ci = vk::DebugReportCallbackCreateInfoEXT{
+          ms.debugFlags, ms.debugCallback ? ms.debugCallback : &debugCallback};
 
+      VkDebugReportCallbackEXT cb;
+      vkCreateDebugReportCallbackEXT(
+          *instance_, &(const VkDebugReportCallbackCreateInfoEXT &)ci,
+          nullptr, &cb);
+      callback_ = cb;
+    }
+
+    // Take the best ranked device, or the one asked for.
     auto pds = instance_->enumeratePhysicalDevices();
-    physical_device_ = pds[0];
+    uint64_t bestScore = 0;
+    for (size_t i = 0; i != pds.size(); ++i) {
+      if (ms.physicalDeviceIndex >= 0 && (size_t)ms.physicalDeviceIndex != i) continue;
+      uint64_t score = rankPhysicalDevice(pds[i], ms);
+      if (score > bestScore) {
+        bestScore = score;
+        physical_device_ = pds[i];
+      }
+    }
+
+    if (!physical_device_) {
+      std::cout << "vku::Framework: no suitable physical device\n";
+      return;
+    }
+
     auto qprops = physical_device_.getQueueFamilyProperties();
     const auto badQueue = ~(uint32_t)0;
     graphicsQueueFamilyIndex_ = badQueue;
@@ -124,30 +314,123 @@ public:
       return;
     }
 
+    // For async compute prefer a dedicated compute family, which usually maps to separate
+    // hardware queues, then a second queue in the omnipurpose family.
+    // Otherwise graphics and compute share queue 0.
+    computeQueueIndex_ = 0;
+    for (uint32_t qi = 0; qi != qprops.size(); ++qi) {
+      auto &qprop = qprops[qi];
+      if ((qprop.queueFlags & vk::QueueFlagBits::eCompute) && !(qprop.queueFlags & vk::QueueFlagBits::eGraphics)) {
+        computeQueueFamilyIndex_ = qi;
+        break;
+      }
+    }
+    if (computeQueueFamilyIndex_ == graphicsQueueFamilyIndex_ && qprops[graphicsQueueFamilyIndex_].queueCount >= 2) {
+      computeQueueIndex_ = 1;
+    }
+
     memprops_ = physical_device_.getMemoryProperties();
 
     // todo: find optimal texture format
     // auto rgbaprops = physical_device_.getFormatProperties(vk::Format::eR8G8B8A8Unorm);
 
+    auto deviceExtensionProps = physical_device_.enumerateDeviceExtensionProperties();
+    auto hasDeviceExt = [&deviceExtensionProps](const char *name) {
+      return hasExtension(deviceExtensionProps, name);
+    };
+
+    FrameworkMaker::Names wantedDeviceExtensions = ms.deviceExtensions;
+    if (ms.surface) wantedDeviceExtensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME, true);
     std::vector<const char *> device_extensions;
-    device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (!selectNames(device_extensions, wantedDeviceExtensions, "device extension", hasDeviceExt)) return;
+
+    auto enableExtension = [&device_extensions](const char *name) {
+      for (auto de : device_extensions) {
+        if (!strcmp(de, name)) return;
+      }
+      device_extensions.push_back(name);
+    };
+
+    // Both extensions below depend on Vulkan 1.1 (or VK_KHR_get_physical_device_properties2)
+    // on the instance and the device.
+    bool is11 = appinfo.apiVersion >= VK_API_VERSION_1_1 && physical_device_.getProperties().apiVersion >= VK_API_VERSION_1_1;
+
+    // Push descriptors let vku::PushDescriptorRecorder skip descriptor set allocation.
+    if (is11 && hasDeviceExt(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+      enableExtension(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+      pushDescriptor_ = true;
+    }
+
+    // GPU driven rendering (see vku::FrustumCuller) draws a count written by a compute shader.
+    if (hasDeviceExt(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+      enableExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+      drawIndirectCount_ = true;
+    }
 
-    float queue_priorities[] = {0.0f};
+    // Required features, and optional features where the device has them.
+    // By default these include multiDrawIndirect and drawIndirectFirstInstance
+    // for many commands per indirect draw, with firstInstance selecting per-instance data,
+    // and pipelineStatisticsQuery and occlusionQueryPrecise for vku::GpuProfiler queries.
+    auto supportedFeatures = physical_device_.getFeatures();
+    vk::PhysicalDeviceFeatures enabledFeatures = ms.requiredFeatures;
+    {
+      auto supported = reinterpret_cast<const VkBool32 *>(&supportedFeatures);
+      auto optional = reinterpret_cast<const VkBool32 *>(&ms.optionalFeatures);
+      auto enabled = reinterpret_cast<VkBool32 *>(&enabledFeatures);
+      for (size_t i = 0; i != sizeof(enabledFeatures) / sizeof(VkBool32); ++i) {
+        if (optional[i] && supported[i]) enabled[i] = VK_TRUE;
+      }
+    }
+    multiDrawIndirect_ = enabledFeatures.multiDrawIndirect != VK_FALSE;
+    pipelineStatisticsQuery_ = enabledFeatures.pipelineStatisticsQuery != VK_FALSE;
+    enabledFeatures_ = enabledFeatures;
+
+    // Enable bindless descriptor arrays (see vku::BindlessTextureTable) if the device has them.
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    if (is11 && hasDeviceExt(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+      auto features = physical_device_.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+      auto &supported = features.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+      // samplers[pc.sampler] is a dynamically uniform index, which is a core feature.
+      if (supported.runtimeDescriptorArray && supported.descriptorBindingPartiallyBound &&
+          supported.descriptorBindingSampledImageUpdateAfterBind && supported.shaderSampledImageArrayNonUniformIndexing &&
+          supportedFeatures.shaderSampledImageArrayDynamicIndexing) {
+        enabledFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        enabledFeatures_ = enabledFeatures;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enableExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        descriptorIndexing_ = true;
+      }
+    }
+
+    deviceExtensions_.assign(device_extensions.begin(), device_extensions.end());
+
+    float queue_priorities[] = {ms.graphicsQueuePriority, ms.computeQueuePriority};
     std::vector<vk::DeviceQueueCreateInfo> qci;
 
-    qci.emplace_back(vk::DeviceQueueCreateFlags{}, graphicsQueueFamilyIndex_, 1,
+    qci.emplace_back(vk::DeviceQueueCreateFlags{}, graphicsQueueFamilyIndex_, computeQueueIndex_ + 1,
                      queue_priorities);
 
     if (computeQueueFamilyIndex_ != graphicsQueueFamilyIndex_) {
       qci.emplace_back(vk::DeviceQueueCreateFlags{}, computeQueueFamilyIndex_, 1,
-                       queue_priorities);
+                       queue_priorities + 1);
     };
 
-    float graphicsQueue_priorities[] = {0.0f};
-    device_ = physical_device_.createDeviceUnique(vk::DeviceCreateInfo{
+    vk::DeviceCreateInfo dci{
         {}, (uint32_t)qci.size(), qci.data(),
         (uint32_t)layers.size(), layers.data(),
-        (uint32_t)device_extensions.size(), device_extensions.data()});
+        (uint32_t)device_extensions.size(), device_extensions.data()};
+    dci.pEnabledFeatures = &enabledFeatures;
+    if (descriptorIndexing_) dci.pNext = &indexingFeatures;
+    device_ = physical_device_.createDeviceUnique(dci);
+
+    // Function pointers straight from the driver for hot recording paths.
+    if (ms.deviceDispatch) {
+      dispatch_.init(*instance_, *device_);
+      deviceDispatch_ = true;
+    }
 
     //vk::Queue graphicsQueue_ = device_->getQueue(graphicsQueueFamilyIndex_, 0);
     //vk::Queue computeQueue_ = device_->getQueue(computeQueueFamilyIndex_, 0);
@@ -159,6 +442,12 @@ public:
     poolSizes.emplace_back(vk::DescriptorType::eUniformBuffer, 128);
     poolSizes.emplace_back(vk::DescriptorType::eCombinedImageSampler, 128);
     poolSizes.emplace_back(vk::DescriptorType::eStorageBuffer, 128);
+    poolSizes.emplace_back(vk::DescriptorType::eUniformBufferDynamic, 32);
+    poolSizes.emplace_back(vk::DescriptorType::eStorageBufferDynamic, 32);
+    poolSizes.emplace_back(vk::DescriptorType::eStorageImage, 32);
+    poolSizes.emplace_back(vk::DescriptorType::eUniformTexelBuffer, 32);
+    poolSizes.emplace_back(vk::DescriptorType::eStorageTexelBuffer, 32);
+    poolSizes.emplace_back(vk::DescriptorType::eInputAttachment, 32);
 
     // Create an arbitrary number of descriptors in a pool.
     // Allow the descriptors to be freed, possibly not optimal behaviour.
@@ -169,10 +458,15 @@ public:
     descriptorPoolInfo.pPoolSizes = poolSizes.data();
     descriptorPool_ = device_->createDescriptorPoolUnique(descriptorPoolInfo);
 
+    // A growable set of pools for scenes that would exhaust the one above.
+    descriptorAllocator_ = vku::DescriptorAllocator(*device_);
+
     ok_ = true;
   }
 
   void dumpCaps(std::ostream &os) const {
+    auto props = physical_device_.getProperties();
+    os << "Device " << props.deviceName << " (" << vk::to_string(props.deviceType) << ")\n";
     os << "Memory Types\n";
     for (uint32_t i = 0; i != memprops_.memoryTypeCount; ++i) {
       os << "  type" << i << " heap" << memprops_.memoryTypes[i].heapIndex << " " << vk::to_string(memprops_.memoryTypes[i].propertyFlags) << "\n";
@@ -193,7 +487,13 @@ public:
   const vk::Queue graphicsQueue() const { return device_->getQueue(graphicsQueueFamilyIndex_, 0); }
 
   /// Get the queue used to submit compute jobs
-  const vk::Queue computeQueue() const { return device_->getQueue(computeQueueFamilyIndex_, 0); }
+  /// This may be a separate queue from graphicsQueue(), see asyncCompute().
+  const vk::Queue computeQueue() const { return device_->getQueue(computeQueueFamilyIndex_, computeQueueIndex_); }
+
+  /// Returns true if compute has its own queue and can run alongside rendering.
+  /// When the families differ, buffers shared with exclusive sharing need a queue family
+  /// ownership transfer, see GenericBuffer::barrier.
+  bool asyncCompute() const { return computeQueueFamilyIndex_ != graphicsQueueFamilyIndex_ || computeQueueIndex_ != 0; }
 
   /// Get the physical device.
   const vk::PhysicalDevice &physicalDevice() const { return physical_device_; }
@@ -204,6 +504,10 @@ public:
   /// Get the default descriptor pool (you can use your own if you like).
   const vk::DescriptorPool descriptorPool() const { return *descriptorPool_; }
 
+  /// Get the default growable descriptor allocator.
+  /// Sets from this allocator live until descriptorAllocator().reset().
+  vku::DescriptorAllocator &descriptorAllocator() { return descriptorAllocator_; }
+
   /// Get the family index for the graphics queues.
   uint32_t graphicsQueueFamilyIndex() const { return graphicsQueueFamilyIndex_; }
 
@@ -212,6 +516,40 @@ public:
 
   const vk::PhysicalDeviceMemoryProperties &memprops() const { return memprops_; }
 
+  /// Returns true if VK_EXT_descriptor_indexing was enabled, so vku::BindlessTextureTable can be used.
+  /// shaderSampledImageArrayDynamicIndexing is enabled with it for the sampler array.
+  bool descriptorIndexing() const { return descriptorIndexing_; }
+
+  /// Returns true if VK_KHR_push_descriptor was enabled, see vku::PushDescriptorRecorder.
+  bool pushDescriptor() const { return pushDescriptor_; }
+
+  /// Returns true if VK_KHR_draw_indirect_count was enabled, see vku::FrustumCuller.
+  bool drawIndirectCount() const { return drawIndirectCount_; }
+
+  /// Returns true if the multiDrawIndirect feature was enabled, see vku::GeometryPool.
+  bool multiDrawIndirect() const { return multiDrawIndirect_; }
+
+  /// Returns true if the pipelineStatisticsQuery feature was enabled, see vku::GpuProfiler::enableQueries.
+  bool pipelineStatisticsQuery() const { return pipelineStatisticsQuery_; }
+
+  /// Get the features enabled on the device: the required ones and the optional ones it has.
+  const vk::PhysicalDeviceFeatures &enabledFeatures() const { return enabledFeatures_; }
+
+  /// Get the device level dispatch table, if FrameworkMaker::deviceDispatch() asked for one.
+  /// Pass it to vulkan.hpp commands and vku calls that take a Dispatch.
+  const vku::DeviceDispatch &dispatch() const { return dispatch_; }
+
+  /// Returns true if dispatch() was built.
+  bool deviceDispatch() const { return deviceDispatch_; }
+
+  /// Returns true if this device extension was enabled.
+  bool hasDeviceExtension(const char *name) const {
+    for (auto &de : deviceExtensions_) {
+      if (de == name) return true;
+    }
+    return false;
+  }
+
   /// Clean up the framework satisfying the Vulkan verification layers.
   ~Framework() {
     if (device_) {
@@ -222,6 +560,7 @@ public:
       if (descriptorPool_) {
         descriptorPool_.reset();
       }
+      descriptorAllocator_ = vku::DescriptorAllocator{};
       device_.reset();
     }
 
@@ -229,7 +568,9 @@ public:
       auto vkDestroyDebugReportCallbackEXT =
           (PFN_vkDestroyDebugReportCallbackEXT)instance_->getProcAddr(
               "vkDestroyDebugReportCallbackEXT");
-      vkDestroyDebugReportCallbackEXT(*instance_, callback_, nullptr);
+      if (callback_ && vkDestroyDebugReportCallbackEXT) {
+        vkDestroyDebugReportCallbackEXT(*instance_, callback_, nullptr);
+      }
       instance_.reset();
     }
   }
@@ -249,15 +590,94 @@ private:
     return VK_FALSE;
   }
 
+  static bool hasExtension(const std::vector<vk::ExtensionProperties> &props, const char *name) {
+    for (auto &ep : props) {
+      if (!strcmp(ep.extensionName, name)) return true;
+    }
+    return false;
+  }
+
+  // Add the wanted names that are available. Returns false if a required one is missing.
+  template <class Available>
+  static bool selectNames(std::vector<const char *> &result, const FrameworkMaker::Names &wanted, const char *what, Available available) {
+    for (auto &w : wanted) {
+      const char *name = w.first.c_str();
+      if (std::find_if(result.begin(), result.end(), [name](const char *r) { return !strcmp(r, name); }) != result.end()) {
+        continue;
+      } else if (available(name)) {
+        result.push_back(name);
+      } else if (w.second) {
+        std::cout << "vku::Framework: missing " << what << " " << name << "\n";
+        return false;
+      } else if (!strcmp(name, "VK_LAYER_LUNARG_standard_validation")) {
+        std::cout << "vku::Framework: validation layers not found\n";
+      }
+    }
+    return true;
+  }
+
+  // Score a device for the maker: zero if it cannot be used, then discrete GPUs first,
+  // integrated, virtual and software devices after and more device local memory breaking ties.
+  static uint64_t rankPhysicalDevice(vk::PhysicalDevice pd, const FrameworkMaker::State &ms) {
+    vk::QueueFlags search = vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute;
+    bool hasQueue = false;
+    for (auto &qprop : pd.getQueueFamilyProperties()) {
+      if ((qprop.queueFlags & search) == search) hasQueue = true;
+    }
+    if (!hasQueue) return 0;
+
+    auto extensionProps = pd.enumerateDeviceExtensionProperties();
+    if (ms.surface && !hasExtension(extensionProps, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) return 0;
+    for (auto &de : ms.deviceExtensions) {
+      if (de.second && !hasExtension(extensionProps, de.first.c_str())) return 0;
+    }
+
+    auto supportedFeatures = pd.getFeatures();
+    auto supported = reinterpret_cast<const VkBool32 *>(&supportedFeatures);
+    auto required = reinterpret_cast<const VkBool32 *>(&ms.requiredFeatures);
+    for (size_t i = 0; i != sizeof(supportedFeatures) / sizeof(VkBool32); ++i) {
+      if (required[i] && !supported[i]) return 0;
+    }
+
+    uint64_t typeRank = 1;
+    switch (pd.getProperties().deviceType) {
+      case vk::PhysicalDeviceType::eDiscreteGpu: typeRank = 5; break;
+      case vk::PhysicalDeviceType::eIntegratedGpu: typeRank = 4; break;
+      case vk::PhysicalDeviceType::eVirtualGpu: typeRank = 3; break;
+      case vk::PhysicalDeviceType::eCpu: typeRank = 2; break;
+      default: break;
+    }
+
+    auto memprops = pd.getMemoryProperties();
+    uint64_t heapMB = 0;
+    for (uint32_t i = 0; i != memprops.memoryHeapCount; ++i) {
+      if (memprops.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+        heapMB = std::max(heapMB, (uint64_t)(memprops.memoryHeaps[i].size >> 20));
+      }
+    }
+    return (typeRank << 40) + std::min(heapMB, ((uint64_t)1 << 40) - 1);
+  }
+
   vk::UniqueInstance instance_;
   vk::UniqueDevice device_;
   vk::DebugReportCallbackEXT callback_;
   vk::PhysicalDevice physical_device_;
   vk::UniquePipelineCache pipelineCache_;
   vk::UniqueDescriptorPool descriptorPool_;
+  vku::DescriptorAllocator descriptorAllocator_;
   uint32_t graphicsQueueFamilyIndex_;
   uint32_t computeQueueFamilyIndex_;
+  uint32_t computeQueueIndex_ = 0;
   vk::PhysicalDeviceMemoryProperties memprops_;
+  bool descriptorIndexing_ = false;
+  bool pushDescriptor_ = false;
+  bool drawIndirectCount_ = false;
+  bool multiDrawIndirect_ = false;
+  bool pipelineStatisticsQuery_ = false;
+  vk::PhysicalDeviceFeatures enabledFeatures_;
+  std::vector<std::string> deviceExtensions_;
+  vku::DeviceDispatch dispatch_;
+  bool deviceDispatch_ = false;
   bool ok_ = false;
 };
 
@@ -492,6 +912,13 @@ public:
   /// Queue the static command buffer for the next image in the swap chain. Optionally call a function to create a dynamic command buffer
   /// for uploading textures, changing uniforms etc.
   void draw(const vk::Device &device, const vk::Queue &graphicsQueue, const std::function<void (vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi)> &dynamic = defaultRenderFunc) {
+    draw(device, graphicsQueue, vk::Semaphore{}, vk::PipelineStageFlags{}, dynamic);
+  }
+
+  /// As draw() above, but the frame also waits for a semaphore at waitStage, for example
+  /// one signalled by culling or particle work on the compute queue. Work on the compute queue
+  /// for this frame can then run alongside the rasterization of the previous frame.
+  void draw(const vk::Device &device, const vk::Queue &graphicsQueue, vk::Semaphore waitSemaphore, vk::PipelineStageFlags waitStage, const std::function<void (vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi)> &dynamic = defaultRenderFunc) {
     static auto start = std::chrono::high_resolution_clock::now();
     auto time = std::chrono::high_resolution_clock::now();
     auto delta = time - start;
@@ -525,15 +952,18 @@ public:
     rpbi.pClearValues = clearColours.data();
     dynamic(pscb, imageIndex, rpbi);
 
+    std::array<vk::Semaphore, 2> dynamicWaitSemas = {iaSema, waitSemaphore};
+    std::array<vk::PipelineStageFlags, 2> dynamicWaitStages = {waitStages, waitStage};
     vk::SubmitInfo submit;
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &iaSema;
-    submit.pWaitDstStageMask = &waitStages;
+    submit.waitSemaphoreCount = waitSemaphore ? 2 : 1;
+    submit.pWaitSemaphores = dynamicWaitSemas.data();
+    submit.pWaitDstStageMask = dynamicWaitStages.data();
     submit.commandBufferCount = 1;
     submit.pCommandBuffers = &pscb;
     submit.signalSemaphoreCount = 1;
     submit.pSignalSemaphores = &psSema;
     graphicsQueue.submit(1, &submit, vk::Fence{});
+    VKU_COUNT(queueSubmits, 1);
 
     submit.waitSemaphoreCount = 1;
     submit.pWaitSemaphores = &psSema;
@@ -543,6 +973,7 @@ public:
     submit.signalSemaphoreCount = 1;
     submit.pSignalSemaphores = &ccSema;
     graphicsQueue.submit(1, &submit, cbFence);
+    VKU_COUNT(queueSubmits, 1);
 
     vk::PresentInfoKHR presentInfo;
     vk::SwapchainKHR swapchain = *swapchain_;
@@ -621,6 +1052,10 @@ public:
   /// Return the number of swap chain images.
   int numImageIndices() const { return (int)images_.size(); }
 
+  /// Return the depth buffer, eg. to build an occlusion culling pyramid from.
+  /// It is left in eDepthStencilAttachmentOptimal at the end of the render pass.
+  vku::DepthStencilImage &depthStencilImage() { return depthStencilImage_; }
+
 private:
   vk::Instance instance_;
   vk::SurfaceKHR surface_;
@@ -0,0 +1,927 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Compact vertex formats for gilgamesh meshes.
+//
+// VertexPacker reads the vertices of a gilgamesh::basic_mesh using the
+// attribute descriptions returned by getFormat() and writes them with
+// quantized formats: unorm16 positions, 10 bit or octahedral normals,
+// half float uvs and unorm8 colours. The result knows its vertex
+// attributes, so pipelines can be built to match.
+//
+// The simple_mesh vertex of 32 bytes packs into 16 bytes.
+//
+// IndexPacker writes 16 bit indices whenever the vertex count allows,
+// splitting larger meshes into chunks of at most 65535 vertices, and
+// optionally converts triangle lists to strips with primitive restart.
+//
+// MeshletBuilder groups triangles into small clusters with bounding spheres
+// and normal cones for vku::ClusterCuller.
+//
+// LodBuilder makes a chain of simplified levels of detail sharing one vertex
+// and one index buffer, and LodChain picks a level by its error on screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_MESH_HPP
+#define VKU_MESH_HPP
+
+#include <vku/vku.hpp>
+#include <vku/vku_culling.hpp>
+#include <gilgamesh/mesh.hpp>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace vku {
+
+/// Vertex data written by VertexPacker with a single binding.
+/// example:
+///     vku::PackedVertices packed = vku::VertexPacker{}.pack(mesh);
+///     vku::HostVertexBuffer vbo(device, memprops, packed.data());
+///     packed.vertexAttributes(pm);
+///     ...
+///     glm::mat4 modelToWorld = objectToWorld * packed.positionTransform();
+class PackedVertices {
+public:
+  /// One vertex attribute. Locations follow the order of the mesh's getFormat().
+  struct Attribute {
+    std::string name;
+    uint32_t location;
+    vk::Format format;
+    uint32_t offset;
+  };
+
+  /// The packed vertices, stride() bytes each.
+  const std::vector<uint8_t> &data() const { return data_; }
+
+  /// Bytes per vertex.
+  uint32_t stride() const { return stride_; }
+
+  /// Number of vertices.
+  size_t size() const { return stride_ ? data_.size() / stride_ : 0; }
+
+  const std::vector<Attribute> &attributes() const { return attributes_; }
+
+  /// Find an attribute by gilgamesh name ("pos", "normal", "uv", "color"...) or return nullptr.
+  const Attribute *attribute(const std::string &name) const {
+    for (auto &a : attributes_) {
+      if (a.name == name) return &a;
+    }
+    return nullptr;
+  }
+
+  /// Add the vertex binding and one vertex attribute per mesh attribute to a pipeline.
+  void vertexAttributes(PipelineMaker &pm, uint32_t binding = 0) const {
+    pm.vertexBinding(binding, stride_);
+    for (auto &a : attributes_) {
+      pm.vertexAttribute(a.location, binding, a.format, a.offset);
+    }
+  }
+
+  /// Quantized positions are stored in 0..1; the mesh position is offset + p * scale.
+  const glm::vec3 &positionScale() const { return positionScale_; }
+  const glm::vec3 &positionOffset() const { return positionOffset_; }
+
+  /// The dequantizing transform. Multiply the model matrix by this.
+  /// This is the identity for float positions.
+  glm::mat4 positionTransform() const {
+    glm::mat4 result(1);
+    result[0][0] = positionScale_.x;
+    result[1][1] = positionScale_.y;
+    result[2][2] = positionScale_.z;
+    result[3] = glm::vec4(positionOffset_, 1);
+    return result;
+  }
+
+  /// Unorm16 uvs are stored in 0..1; the mesh uv is offset + uv * scale.
+  /// Pass (scale.x, scale.y, offset.x, offset.y) to the vertex shader.
+  glm::vec4 uvTransform() const { return glm::vec4(uvScale_, uvOffset_); }
+
+private:
+  std::vector<uint8_t> data_;
+  std::vector<Attribute> attributes_;
+  uint32_t stride_ = 0;
+  glm::vec3 positionScale_ = glm::vec3(1);
+  glm::vec3 positionOffset_ = glm::vec3(0);
+  glm::vec2 uvScale_ = glm::vec2(1);
+  glm::vec2 uvOffset_ = glm::vec2(0);
+  friend class VertexPacker;
+};
+
+/// Pack the vertices of a gilgamesh mesh into compact formats.
+/// The defaults need no vertex shader changes beyond the dequantizing
+/// transform: attributes with four components can be read as vec3.
+class VertexPacker {
+public:
+  enum class Positions {
+    /// eR32G32B32Sfloat, 12 bytes.
+    float32,
+
+    /// eR16G16B16A16Unorm relative to the bounding box, 8 bytes. See PackedVertices::positionTransform().
+    unorm16,
+  };
+
+  enum class Normals {
+    /// eR32G32B32Sfloat, 12 bytes.
+    float32,
+
+    /// x, y and z in eA2B10G10R10SnormPack32, 4 bytes.
+    snorm10,
+
+    /// Octahedral encoding in eR16G16Snorm, 4 bytes.
+    /// More accurate than snorm10 but the shader must decode the normal:
+    ///     vec3 octDecode(vec2 e) {
+    ///       vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    ///       if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+    ///       return normalize(n);
+    ///     }
+    octahedral,
+  };
+
+  enum class Uvs {
+    /// eR32G32Sfloat, 8 bytes.
+    float32,
+
+    /// eR16G16Sfloat, 4 bytes.
+    half,
+
+    /// eR16G16Unorm relative to the uv bounds, 4 bytes. See PackedVertices::uvTransform().
+    unorm16,
+  };
+
+  enum class Colors {
+    /// eR32G32B32A32Sfloat, 16 bytes.
+    float32,
+
+    /// eR8G8B8A8Unorm, 4 bytes.
+    unorm8,
+  };
+
+  VertexPacker() {
+  }
+
+  VertexPacker &positions(Positions value) { s.positions = value; return *this; }
+  VertexPacker &normals(Normals value) { s.normals = value; return *this; }
+  VertexPacker &uvs(Uvs value) { s.uvs = value; return *this; }
+  VertexPacker &colors(Colors value) { s.colors = value; return *this; }
+
+  /// Fall back to float formats for any the device can not read from vertex buffers.
+  VertexPacker &physicalDevice(vk::PhysicalDevice value) { s.physicalDevice = value; return *this; }
+
+  /// Pack the vertices of a gilgamesh::basic_mesh. The indices are unchanged.
+  template <class Mesh>
+  PackedVertices pack(const Mesh &mesh) const {
+    auto &vertices = mesh.vertices();
+    const uint8_t *src = (const uint8_t *)vertices.data();
+    size_t srcStride = sizeof(vertices[0]);
+    PackedVertices result;
+
+    // Choose a format and destination offset for each source attribute.
+    std::vector<Field> fields;
+    uint32_t srcOffset = 0, dstOffset = 0, location = 0;
+    for (auto fp = mesh.getFormat(); fp->name; ++fp) {
+      // Only float attributes are written by gilgamesh.
+      if (fp->type != 'f') return PackedVertices{};
+      Field f{};
+      f.kind = kindOf(fp->name, fp->number_of_channels);
+      f.channels = fp->number_of_channels;
+      f.srcOffset = srcOffset;
+      f.encoding = chooseEncoding(f.kind);
+      f.format = formatOf(f.encoding, f.channels);
+      f.dstOffset = dstOffset;
+      srcOffset += fp->number_of_channels * (uint32_t)sizeof(float);
+      dstOffset += bytesOf(f.encoding, f.channels);
+      result.attributes_.push_back(PackedVertices::Attribute{fp->name, location++, f.format, f.dstOffset});
+      fields.push_back(f);
+    }
+    result.stride_ = dstOffset;
+
+    // Bounds of positions and uvs for the unorm16 encodings.
+    for (auto &f : fields) {
+      if (f.encoding != Encoding::unorm16x4 && f.encoding != Encoding::unorm16x2) continue;
+      glm::vec3 lo(0), hi(0);
+      for (size_t i = 0; i != vertices.size(); ++i) {
+        glm::vec3 v = read(src + i * srcStride + f.srcOffset, f.channels);
+        lo = i ? glm::min(lo, v) : v;
+        hi = i ? glm::max(hi, v) : v;
+      }
+      glm::vec3 range = hi - lo;
+      for (int j = 0; j != 3; ++j) {
+        if (range[j] <= 0) range[j] = 1;
+      }
+      if (f.kind == Kind::pos) {
+        result.positionOffset_ = lo;
+        result.positionScale_ = range;
+      } else {
+        result.uvOffset_ = glm::vec2(lo);
+        result.uvScale_ = glm::vec2(range);
+      }
+    }
+
+    result.data_.resize(vertices.size() * result.stride_);
+    uint8_t *dst = result.data_.data();
+    for (size_t i = 0; i != vertices.size(); ++i) {
+      const uint8_t *sv = src + i * srcStride;
+      uint8_t *dv = dst + i * result.stride_;
+      for (auto &f : fields) {
+        const uint8_t *sp = sv + f.srcOffset;
+        uint8_t *dp = dv + f.dstOffset;
+        switch (f.encoding) {
+          case Encoding::float32: {
+            memcpy(dp, sp, f.channels * sizeof(float));
+          } break;
+          case Encoding::unorm16x4: {
+            glm::vec3 p = (read(sp, f.channels) - result.positionOffset_) / result.positionScale_;
+            store(dp, glm::packUnorm4x16(glm::vec4(p, 1)));
+          } break;
+          case Encoding::snorm10: {
+            store(dp, glm::packSnorm3x10_1x2(glm::vec4(normalize(read(sp, f.channels)), 0)));
+          } break;
+          case Encoding::octahedral: {
+            glm::vec2 e = octEncode(normalize(read(sp, f.channels)));
+            store(dp, glm::packSnorm2x16(e));
+          } break;
+          case Encoding::half2: {
+            store(dp, glm::packHalf2x16(glm::vec2(read(sp, f.channels))));
+          } break;
+          case Encoding::unorm16x2: {
+            glm::vec2 uv = (glm::vec2(read(sp, f.channels)) - result.uvOffset_) / result.uvScale_;
+            store(dp, glm::packUnorm2x16(uv));
+          } break;
+          case Encoding::unorm8x4: {
+            glm::vec4 c(0, 0, 0, 1);
+            memcpy(&c, sp, f.channels * sizeof(float));
+            store(dp, glm::packUnorm4x8(c));
+          } break;
+        }
+      }
+    }
+    return result;
+  }
+
+  /// Octahedral encoding of a unit vector to -1..1.
+  static glm::vec2 octEncode(const glm::vec3 &n) {
+    glm::vec2 p = glm::vec2(n) * (1.0f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z)));
+    if (n.z < 0) {
+      p = (glm::vec2(1) - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0 ? 1.0f : -1.0f, p.y >= 0 ? 1.0f : -1.0f);
+    }
+    return p;
+  }
+
+  /// Inverse of octEncode(), as the shader does it.
+  static glm::vec3 octDecode(const glm::vec2 &e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if (n.z < 0) {
+      glm::vec2 xy = (glm::vec2(1) - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0 ? 1.0f : -1.0f, n.y >= 0 ? 1.0f : -1.0f);
+      n.x = xy.x;
+      n.y = xy.y;
+    }
+    return glm::normalize(n);
+  }
+
+private:
+  enum class Kind { pos, normal, uv, color, other };
+  enum class Encoding { float32, unorm16x4, snorm10, octahedral, half2, unorm16x2, unorm8x4 };
+
+  struct Field {
+    Kind kind;
+    Encoding encoding;
+    vk::Format format;
+    int channels;
+    uint32_t srcOffset;
+    uint32_t dstOffset;
+  };
+
+  static Kind kindOf(const char *name, int channels) {
+    std::string n = name;
+    if (n == "pos" && channels == 3) return Kind::pos;
+    if (n == "normal" && channels == 3) return Kind::normal;
+    if (n == "uv" && channels == 2) return Kind::uv;
+    if (n == "color" && channels == 4) return Kind::color;
+    return Kind::other;
+  }
+
+  Encoding chooseEncoding(Kind kind) const {
+    Encoding e = Encoding::float32;
+    switch (kind) {
+      case Kind::pos: if (s.positions == Positions::unorm16) e = Encoding::unorm16x4; break;
+      case Kind::normal: {
+        if (s.normals == Normals::snorm10) e = Encoding::snorm10;
+        if (s.normals == Normals::octahedral) e = Encoding::octahedral;
+      } break;
+      case Kind::uv: {
+        if (s.uvs == Uvs::half) e = Encoding::half2;
+        if (s.uvs == Uvs::unorm16) e = Encoding::unorm16x2;
+      } break;
+      case Kind::color: if (s.colors == Colors::unorm8) e = Encoding::unorm8x4; break;
+      case Kind::other: break;
+    }
+    if (e != Encoding::float32 && s.physicalDevice) {
+      auto props = s.physicalDevice.getFormatProperties(formatOf(e, 0));
+      if (!(props.bufferFeatures & vk::FormatFeatureFlagBits::eVertexBuffer)) e = Encoding::float32;
+    }
+    return e;
+  }
+
+  static vk::Format formatOf(Encoding e, int channels) {
+    switch (e) {
+      case Encoding::unorm16x4: return vk::Format::eR16G16B16A16Unorm;
+      case Encoding::snorm10: return vk::Format::eA2B10G10R10SnormPack32;
+      case Encoding::octahedral: return vk::Format::eR16G16Snorm;
+      case Encoding::half2: return vk::Format::eR16G16Sfloat;
+      case Encoding::unorm16x2: return vk::Format::eR16G16Unorm;
+      case Encoding::unorm8x4: return vk::Format::eR8G8B8A8Unorm;
+      case Encoding::float32: break;
+    }
+    switch (channels) {
+      case 1: return vk::Format::eR32Sfloat;
+      case 2: return vk::Format::eR32G32Sfloat;
+      case 3: return vk::Format::eR32G32B32Sfloat;
+      default: return vk::Format::eR32G32B32A32Sfloat;
+    }
+  }
+
+  static uint32_t bytesOf(Encoding e, int channels) {
+    switch (e) {
+      case Encoding::unorm16x4: return 8;
+      case Encoding::float32: return channels * (uint32_t)sizeof(float);
+      default: return 4;
+    }
+  }
+
+  // Read up to three floats, filling the rest with zero.
+  static glm::vec3 read(const uint8_t *sp, int channels) {
+    glm::vec3 v(0);
+    memcpy(&v, sp, std::min(channels, 3) * sizeof(float));
+    return v;
+  }
+
+  static glm::vec3 normalize(const glm::vec3 &n) {
+    float len = glm::length(n);
+    return len > 0 ? n / len : glm::vec3(0, 0, 1);
+  }
+
+  template <class Type>
+  static void store(uint8_t *dp, Type value) {
+    memcpy(dp, &value, sizeof(value));
+  }
+
+  struct State {
+    Positions positions = Positions::unorm16;
+    Normals normals = Normals::snorm10;
+    Uvs uvs = Uvs::half;
+    Colors colors = Colors::unorm8;
+    vk::PhysicalDevice physicalDevice;
+  };
+
+  State s;
+};
+
+/// Index data written by IndexPacker, drawn as one or more chunks.
+/// example:
+///     vku::PackedIndices indices = vku::IndexPacker{}.pack(mesh);
+///     vku::HostIndexBuffer ibo(device, memprops, indices.data());
+///     indices.inputAssembly(pm);
+///     ...
+///     cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), indices.indexType());
+///     indices.draw(cb);
+class PackedIndices {
+public:
+  /// A range of indices that address at most 65535 vertices from vertexOffset.
+  struct Chunk {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+  };
+
+  /// The packed indices, two or four bytes each.
+  const std::vector<uint8_t> &data() const { return data_; }
+
+  /// eUint16 unless the mesh has more than 65535 vertices and was not split.
+  vk::IndexType indexType() const { return indexType_; }
+
+  /// eTriangleList or eTriangleStrip.
+  vk::PrimitiveTopology topology() const { return topology_; }
+
+  /// True for strips, which are separated by the all ones restart index.
+  bool primitiveRestart() const { return topology_ == vk::PrimitiveTopology::eTriangleStrip; }
+
+  const std::vector<Chunk> &chunks() const { return chunks_; }
+
+  /// Total number of indices, including restart indices.
+  uint32_t indexCount() const { return (uint32_t)(data_.size() / (indexType_ == vk::IndexType::eUint16 ? 2 : 4)); }
+
+  /// Set the topology and primitive restart of a pipeline to match.
+  void inputAssembly(PipelineMaker &pm) const {
+    pm.topology(topology_);
+    pm.primitiveRestartEnable(primitiveRestart() ? VK_TRUE : VK_FALSE);
+  }
+
+  /// Draw every chunk. The index buffer must be bound with indexType().
+  template <class Dispatch = vk::DispatchLoaderStatic>
+  void draw(vk::CommandBuffer cb, uint32_t instanceCount = 1, uint32_t firstInstance = 0, const Dispatch &d = Dispatch()) const {
+    for (auto &c : chunks_) {
+      cb.drawIndexed(c.indexCount, instanceCount, c.firstIndex, c.vertexOffset, firstInstance, d);
+    }
+  }
+
+private:
+  std::vector<uint8_t> data_;
+  std::vector<Chunk> chunks_;
+  vk::IndexType indexType_ = vk::IndexType::eUint16;
+  vk::PrimitiveTopology topology_ = vk::PrimitiveTopology::eTriangleList;
+  friend class IndexPacker;
+};
+
+/// Pack the triangle indices of a gilgamesh mesh into 16 bit indices.
+/// Meshes with more than 65535 vertices are split into chunks. Splitting
+/// reorders the mesh's vertices so that each chunk's vertices are contiguous,
+/// duplicating those shared between chunks, so pack the indices before the vertices.
+class IndexPacker {
+public:
+  IndexPacker() {
+  }
+
+  /// Split large meshes into 16 bit chunks (default). Otherwise use 32 bit indices for them.
+  IndexPacker &split(bool value) { s.split = value; return *this; }
+
+  /// Convert to triangle strips with primitive restart if that needs fewer indices.
+  /// Strips follow triangle adjacency, so they may undo some vertex cache ordering.
+  IndexPacker &strips(bool value) { s.strips = value; return *this; }
+
+  /// Largest number of vertices in a chunk. The all ones index is kept for restarts.
+  static const uint32_t maxChunkVertices = 0xffff;
+
+  template <class Mesh>
+  PackedIndices pack(Mesh &mesh) const {
+    typedef typename Mesh::index_t index_t;
+    auto &vertices = mesh.vertices();
+    auto &indices = mesh.indices();
+    size_t numTriangles = indices.size() / 3;
+    PackedIndices result;
+
+    // Triangle ranges of each chunk.
+    struct Range { size_t first, count; int32_t vertexOffset; };
+    std::vector<Range> ranges;
+
+    bool wide = vertices.size() > maxChunkVertices;
+    if (!wide || !s.split) {
+      ranges.push_back(Range{0, numTriangles, 0});
+      if (wide) result.indexType_ = vk::IndexType::eUint32;
+    } else {
+      // Add triangles to a chunk until its vertices would not fit,
+      // copying each chunk's vertices to the end of a new vertex array.
+      typedef typename Mesh::vertex_t vertex_t;
+      std::vector<vertex_t> newVertices;
+      std::vector<index_t> newIndices(numTriangles * 3);
+      std::vector<uint32_t> chunkOf(vertices.size(), ~0u);
+      std::vector<uint32_t> newIndex(vertices.size());
+      Range range{0, 0, 0};
+      for (size_t t = 0; t != numTriangles; ++t) {
+        uint32_t added = 0;
+        for (int j = 0; j != 3; ++j) {
+          added += chunkOf[indices[t * 3 + j]] != ranges.size();
+        }
+        if (newVertices.size() - range.vertexOffset + added > maxChunkVertices) {
+          ranges.push_back(range);
+          range = Range{t, 0, (int32_t)newVertices.size()};
+        }
+        for (int j = 0; j != 3; ++j) {
+          index_t i = indices[t * 3 + j];
+          if (chunkOf[i] != ranges.size()) {
+            chunkOf[i] = (uint32_t)ranges.size();
+            newIndex[i] = (uint32_t)newVertices.size();
+            newVertices.push_back(vertices[i]);
+          }
+          newIndices[t * 3 + j] = (index_t)newIndex[i];
+        }
+        ++range.count;
+      }
+      if (range.count) ranges.push_back(range);
+      vertices = std::move(newVertices);
+      indices = std::move(newIndices);
+    }
+
+    // Chunk relative indices as lists and, if asked for, as strips.
+    uint32_t restart = result.indexType_ == vk::IndexType::eUint16 ? 0xffff : 0xffffffff;
+    std::vector<uint32_t> lists, strips, local;
+    std::vector<PackedIndices::Chunk> listChunks, stripChunks;
+    for (auto &r : ranges) {
+      local.resize(r.count * 3);
+      for (size_t i = 0; i != local.size(); ++i) {
+        local[i] = (uint32_t)(indices[r.first * 3 + i] - r.vertexOffset);
+      }
+      listChunks.push_back(PackedIndices::Chunk{(uint32_t)lists.size(), (uint32_t)local.size(), r.vertexOffset});
+      lists.insert(lists.end(), local.begin(), local.end());
+      if (s.strips) {
+        uint32_t first = (uint32_t)strips.size();
+        stripify(local, restart, strips);
+        stripChunks.push_back(PackedIndices::Chunk{first, (uint32_t)strips.size() - first, r.vertexOffset});
+      }
+    }
+
+    // The topology is fixed per pipeline, so the whole mesh is either strips or lists.
+    bool useStrips = s.strips && strips.size() < lists.size();
+    auto &packed = useStrips ? strips : lists;
+    result.chunks_ = useStrips ? stripChunks : listChunks;
+    if (useStrips) result.topology_ = vk::PrimitiveTopology::eTriangleStrip;
+
+    if (result.indexType_ == vk::IndexType::eUint16) {
+      result.data_.resize(packed.size() * sizeof(uint16_t));
+      uint16_t *dp = (uint16_t *)result.data_.data();
+      for (size_t i = 0; i != packed.size(); ++i) dp[i] = (uint16_t)packed[i];
+    } else {
+      result.data_.resize(packed.size() * sizeof(uint32_t));
+      memcpy(result.data_.data(), packed.data(), result.data_.size());
+    }
+    return result;
+  }
+
+  /// Convert a triangle list to strips separated by restart, appending to result.
+  /// Each strip grows greedily across shared edges, keeping the triangles' winding.
+  static void stripify(const std::vector<uint32_t> &tris, uint32_t restart, std::vector<uint32_t> &result) {
+    size_t numTriangles = tris.size() / 3;
+
+    // Directed edges (a << 32 | b) of every triangle, sorted for lookup.
+    std::vector<std::pair<uint64_t, uint32_t>> edges;
+    edges.reserve(numTriangles * 3);
+    auto key = [](uint32_t a, uint32_t b) { return (uint64_t)a << 32 | b; };
+    for (size_t t = 0; t != numTriangles; ++t) {
+      for (int j = 0; j != 3; ++j) {
+        edges.emplace_back(key(tris[t * 3 + j], tris[t * 3 + (j + 1) % 3]), (uint32_t)t);
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> used(numTriangles);
+
+    // Find an unused triangle with the directed edge a->b.
+    auto find = [&](uint32_t a, uint32_t b) -> size_t {
+      auto k = key(a, b);
+      auto i = std::lower_bound(edges.begin(), edges.end(), std::make_pair(k, 0u));
+      for (; i != edges.end() && i->first == k; ++i) {
+        if (!used[i->second]) return i->second;
+      }
+      return numTriangles;
+    };
+
+    // The vertex after the edge a->b in triangle t.
+    auto third = [&](size_t t, uint32_t a, uint32_t b) {
+      const uint32_t *v = tris.data() + t * 3;
+      for (int j = 0; j != 3; ++j) {
+        if (v[j] == a && v[(j + 1) % 3] == b) return v[(j + 2) % 3];
+      }
+      return v[2];
+    };
+
+    bool first = true;
+    for (size_t seed = 0; seed != numTriangles; ++seed) {
+      if (used[seed]) continue;
+      used[seed] = true;
+
+      // Start with the rotation of the seed that has a neighbour across its last edge.
+      const uint32_t *v = tris.data() + seed * 3;
+      int rot = 0;
+      for (int r = 0; r != 3; ++r) {
+        if (find(v[(r + 2) % 3], v[(r + 1) % 3]) != numTriangles) {
+          rot = r;
+          break;
+        }
+      }
+      if (!first) result.push_back(restart);
+      first = false;
+      for (int j = 0; j != 3; ++j) {
+        result.push_back(v[(rot + j) % 3]);
+      }
+
+      // Triangle n of a strip is (v[n], v[n+1], v[n+2]) for even n and (v[n+1], v[n], v[n+2]) for odd n.
+      for (size_t n = 1; ; ++n) {
+        uint32_t p = result[result.size() - 2], q = result.back();
+        uint32_t a = n & 1 ? q : p, b = n & 1 ? p : q;
+        size_t t = find(a, b);
+        if (t == numTriangles) break;
+        used[t] = true;
+        result.push_back(third(t, a, b));
+      }
+    }
+  }
+
+private:
+  struct State {
+    bool split = true;
+    bool strips = false;
+  };
+
+  State s;
+};
+
+/// Group the triangles of a gilgamesh mesh into clusters of at most maxVertices
+/// vertices and maxTriangles triangles for vku::ClusterCuller.
+/// Clusters grow across shared vertices, preferring triangles that add the fewest
+/// vertices and whose normals are closest to the cluster's, which keeps the cones narrow.
+/// The mesh's indices are reordered so that each cluster is a range of them.
+/// example:
+///     mesh.optimize();
+///     std::vector<vku::CullCluster> clusters = vku::MeshletBuilder{}.build(mesh);
+///     vku::HostIndexBuffer ibo(device, memprops, mesh.indices32());
+class MeshletBuilder {
+public:
+  MeshletBuilder() {
+  }
+
+  /// Largest number of distinct vertices in a cluster (default 64).
+  MeshletBuilder &maxVertices(uint32_t value) { s.maxVertices = std::max(value, 3u); return *this; }
+
+  /// Largest number of triangles in a cluster (default 124).
+  MeshletBuilder &maxTriangles(uint32_t value) { s.maxTriangles = std::max(value, 1u); return *this; }
+
+  /// How much to favour narrow cones over sharing vertices, from 0 to 1 (default 0.5).
+  MeshletBuilder &coneWeight(float value) { s.coneWeight = value; return *this; }
+
+  template <class Mesh>
+  std::vector<CullCluster> build(Mesh &mesh) const {
+    typedef typename Mesh::index_t index_t;
+    auto &vertices = mesh.vertices();
+    auto &indices = mesh.indices();
+    size_t numTriangles = indices.size() / 3;
+    size_t numVertices = vertices.size();
+
+    // Triangles using each vertex.
+    std::vector<uint32_t> adjStart(numVertices + 1), adj(numTriangles * 3);
+    for (auto i : indices) ++adjStart[i + 1];
+    for (size_t v = 0; v != numVertices; ++v) adjStart[v + 1] += adjStart[v];
+    {
+      std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+      for (size_t i = 0; i != numTriangles * 3; ++i) adj[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<glm::vec3> normals(numTriangles);
+    for (size_t t = 0; t != numTriangles; ++t) {
+      normals[t] = triangleNormal(vertices, indices, t);
+    }
+
+    std::vector<CullCluster> result;
+    std::vector<index_t> newIndices;
+    newIndices.reserve(numTriangles * 3);
+    std::vector<bool> used(numTriangles);
+    std::vector<uint32_t> inCluster(numVertices, ~0u);
+    std::vector<uint32_t> clusterVertices, clusterTriangles, candidates;
+
+    for (size_t seed = 0; seed != numTriangles; ++seed) {
+      if (used[seed]) continue;
+      uint32_t id = (uint32_t)result.size();
+      clusterVertices.clear();
+      clusterTriangles.clear();
+      candidates.clear();
+      glm::vec3 normalSum(0);
+
+      auto add = [&](uint32_t t) {
+        used[t] = true;
+        clusterTriangles.push_back(t);
+        normalSum += normals[t];
+        for (int j = 0; j != 3; ++j) {
+          index_t v = indices[t * 3 + j];
+          if (inCluster[v] == id) continue;
+          inCluster[v] = id;
+          clusterVertices.push_back((uint32_t)v);
+          candidates.insert(candidates.end(), adj.begin() + adjStart[v], adj.begin() + adjStart[v + 1]);
+        }
+      };
+      add((uint32_t)seed);
+
+      while (clusterTriangles.size() < s.maxTriangles) {
+        glm::vec3 axis = safeNormalize(normalSum);
+        size_t best = numTriangles;
+        float bestScore = 0;
+        for (size_t c = 0; c != candidates.size(); ) {
+          uint32_t t = candidates[c];
+          if (used[t]) {
+            // Remove used triangles as they are found.
+            candidates[c] = candidates.back();
+            candidates.pop_back();
+            continue;
+          }
+          ++c;
+          uint32_t added = 0;
+          for (int j = 0; j != 3; ++j) added += inCluster[indices[t * 3 + j]] != id;
+          if (clusterVertices.size() + added > s.maxVertices) continue;
+          float score = added - s.coneWeight * 2 * glm::dot(normals[t], axis);
+          if (best == numTriangles || score < bestScore) {
+            best = t;
+            bestScore = score;
+          }
+        }
+        if (best == numTriangles) break;
+        add((uint32_t)best);
+      }
+
+      CullCluster cluster{};
+      cluster.firstIndex = (uint32_t)newIndices.size();
+      cluster.indexCount = (uint32_t)clusterTriangles.size() * 3;
+      for (auto t : clusterTriangles) {
+        for (int j = 0; j != 3; ++j) newIndices.push_back(indices[t * 3 + j]);
+      }
+      bounds(vertices, clusterVertices, clusterTriangles, normals, cluster);
+      result.push_back(cluster);
+    }
+
+    indices = std::move(newIndices);
+    return result;
+  }
+
+private:
+  template <class Vertices, class Indices>
+  static glm::vec3 triangleNormal(const Vertices &vertices, const Indices &indices, size_t t) {
+    glm::vec3 p0 = vertices[indices[t * 3 + 0]].pos();
+    glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos();
+    glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos();
+    return safeNormalize(glm::cross(p1 - p0, p2 - p0));
+  }
+
+  static glm::vec3 safeNormalize(const glm::vec3 &v) {
+    float len = glm::length(v);
+    return len > 0 ? v / len : glm::vec3(0);
+  }
+
+  // Bounding sphere about the centre of the box, and the normal cone.
+  template <class Vertices>
+  static void bounds(const Vertices &vertices, const std::vector<uint32_t> &clusterVertices, const std::vector<uint32_t> &clusterTriangles, const std::vector<glm::vec3> &normals, CullCluster &cluster) {
+    glm::vec3 lo = vertices[clusterVertices[0]].pos(), hi = lo;
+    for (auto v : clusterVertices) {
+      lo = glm::min(lo, vertices[v].pos());
+      hi = glm::max(hi, vertices[v].pos());
+    }
+    glm::vec3 centre = (lo + hi) * 0.5f;
+    float radius = 0;
+    for (auto v : clusterVertices) {
+      radius = std::max(radius, glm::length(vertices[v].pos() - centre));
+    }
+
+    // The cone contains every normal; nearly flat cones and degenerate triangles never cull.
+    glm::vec3 sum(0);
+    for (auto t : clusterTriangles) sum += normals[t];
+    glm::vec3 axis = safeNormalize(sum);
+    float minDot = 1;
+    for (auto t : clusterTriangles) {
+      minDot = std::min(minDot, normals[t] == glm::vec3(0) ? -1.0f : glm::dot(normals[t], axis));
+    }
+    float cutoff = axis == glm::vec3(0) || minDot <= 0.1f ? 1.0f : std::sqrt(1 - minDot * minDot);
+
+    cluster.sphere[0] = centre.x;
+    cluster.sphere[1] = centre.y;
+    cluster.sphere[2] = centre.z;
+    cluster.sphere[3] = radius;
+    cluster.cone[0] = axis.x;
+    cluster.cone[1] = axis.y;
+    cluster.cone[2] = axis.z;
+    cluster.cone[3] = cutoff;
+  }
+
+  struct State {
+    uint32_t maxVertices = 64;
+    uint32_t maxTriangles = 124;
+    float coneWeight = 0.5f;
+  };
+
+  State s;
+};
+
+/// Levels of detail of a mesh, stored one after another in one index buffer.
+/// All levels index the mesh's own vertices.
+/// example:
+///     vku::LodChain lods = vku::LodBuilder{}.build(mesh);
+///     vku::HostIndexBuffer ibo(device, memprops, lods.data());
+///     float projection = vku::LodChain::projectionScale(glm::radians(45.0f), (float)window.height());
+///     ...
+///     cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), lods.indexType());
+///     lods.draw(cb, lods.select(distance, projection));
+class LodChain {
+public:
+  /// One level: a range of the index buffer, and an estimate of its distance from
+  /// the full detail surface in the units of the vertex positions.
+  struct Level {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+  };
+
+  /// The indices of every level, two or four bytes each.
+  const std::vector<uint8_t> &data() const { return data_; }
+
+  /// eUint16 if the mesh has at most 65536 vertices.
+  vk::IndexType indexType() const { return indexType_; }
+
+  /// The levels from full detail to coarsest, with increasing errors.
+  const std::vector<Level> &levels() const { return levels_; }
+
+  /// Pixels covered by one unit at a distance of one unit, for a perspective
+  /// projection with a vertical field of view of fovy radians.
+  static float projectionScale(float fovy, float viewportHeight) {
+    return viewportHeight / (2 * std::tan(fovy * 0.5f));
+  }
+
+  /// The coarsest level whose error is at most maxPixels on screen.
+  /// distance is from the eye to the nearest point of the object, eg. of its bounding sphere,
+  /// and scale is the object to world scale.
+  uint32_t select(float distance, float projectionScale, float maxPixels = 1.0f, float scale = 1.0f) const {
+    uint32_t result = 0;
+    float limit = maxPixels * std::max(distance, 0.0f) / (projectionScale * scale);
+    for (uint32_t i = 1; i < levels_.size() && levels_[i].error <= limit; ++i) {
+      result = i;
+    }
+    return result;
+  }
+
+  /// Draw a level. The index buffer must be bound with indexType().
+  template <class Dispatch = vk::DispatchLoaderStatic>
+  void draw(vk::CommandBuffer cb, uint32_t level, uint32_t instanceCount = 1, uint32_t firstInstance = 0, const Dispatch &d = Dispatch()) const {
+    if (level >= levels_.size()) return;
+    auto &l = levels_[level];
+    cb.drawIndexed(l.indexCount, instanceCount, l.firstIndex, 0, firstInstance, d);
+  }
+
+private:
+  std::vector<uint8_t> data_;
+  std::vector<Level> levels_;
+  vk::IndexType indexType_ = vk::IndexType::eUint16;
+  friend class LodBuilder;
+};
+
+/// Build a LodChain with gilgamesh's quadric error simplifier.
+/// Each level has about ratio times the triangles of the one before.
+class LodBuilder {
+public:
+  LodBuilder() {
+  }
+
+  /// Most levels, including full detail (default 6).
+  LodBuilder &levels(uint32_t value) { s.levels = std::max(value, 1u); return *this; }
+
+  /// Triangles of each level relative to the previous one (default 0.5).
+  LodBuilder &ratio(float value) { s.ratio = value; return *this; }
+
+  /// Stop when the error would exceed this, in the units of the positions.
+  LodBuilder &maxError(float value) { s.maxError = value; return *this; }
+
+  /// Stop at levels with fewer triangles than this (default 16).
+  LodBuilder &minTriangles(size_t value) { s.minTriangles = value; return *this; }
+
+  template <class Mesh>
+  LodChain build(const Mesh &mesh) const {
+    auto &indices = mesh.indices();
+    std::vector<size_t> targets;
+    double count = (double)(indices.size() / 3);
+    for (uint32_t i = 1; i < s.levels; ++i) {
+      count *= s.ratio;
+      if (count < s.minTriangles) break;
+      targets.push_back((size_t)count);
+    }
+
+    LodChain result;
+    result.indexType_ = mesh.vertices().size() <= 0x10000 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+    append(result, indices, 0);
+    for (auto &lod : mesh.simplify(targets, s.maxError)) {
+      append(result, lod.indices, lod.error);
+    }
+    return result;
+  }
+
+private:
+  template <class Indices>
+  static void append(LodChain &chain, const Indices &indices, float error) {
+    size_t size = chain.indexType_ == vk::IndexType::eUint16 ? 2 : 4;
+    size_t first = chain.data_.size() / size;
+    chain.data_.resize(chain.data_.size() + indices.size() * size);
+    uint8_t *dp = chain.data_.data() + first * size;
+    for (size_t i = 0; i != indices.size(); ++i, dp += size) {
+      if (size == 2) {
+        uint16_t value = (uint16_t)indices[i];
+        memcpy(dp, &value, size);
+      } else {
+        uint32_t value = (uint32_t)indices[i];
+        memcpy(dp, &value, size);
+      }
+    }
+    chain.levels_.push_back(LodChain::Level{(uint32_t)first, (uint32_t)indices.size(), error});
+  }
+
+  struct State {
+    uint32_t levels = 6;
+    float ratio = 0.5f;
+    float maxError = std::numeric_limits<float>::max();
+    size_t minTriangles = 16;
+  };
+
+  State s;
+};
+
+} // namespace vku
+
+#endif // VKU_MESH_HPP
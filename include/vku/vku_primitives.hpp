@@ -0,0 +1,256 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU parallel primitives for the Vookoo high level C++ Vulkan interface.
+//
+// Scan, reduction, stream compaction and key-value radix sort of uint32_t
+// values in GenericBuffers, recorded into your own command buffers.
+//
+// The compute shaders are in the shaders/ directory and must be compiled
+// to SPIR-V, eg. as benchmarks/CMakeLists.txt does:
+//
+//   glslangValidator -V scan.comp -o scan.comp.spv
+//   glslangValidator -V --target-env vulkan1.1 -DSUBGROUP scan.comp -o scan.subgroup.comp.spv
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_PRIMITIVES_HPP
+#define VKU_PRIMITIVES_HPP
+
+#include <vku/vku.hpp>
+
+namespace vku {
+
+/// Scan, reduce, compact and sort uint32_t values on the GPU.
+/// Each call records dispatches and barriers into a command buffer; nothing is submitted.
+/// Buffers need eStorageBuffer usage and reduce() outputs also need eTransferDst.
+/// example:
+///     vku::Primitives prims{device, memprops, queueFamilyIndex, BINARY_DIR};
+///     vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
+///       prims.exclusiveScan(cb, input, output, count);
+///       prims.sort(cb, keys, values, count);
+///     });
+///     prims.beginFrame(0); // release descriptor sets once the GPU has finished.
+///
+/// Scratch buffers are kept per frame in flight and selected by beginFrame(), so calls for
+/// different frames may run at once. Calls within one frame are ordered by the barrier each ends with.
+///
+/// The workgroup size is a specialization constant and must be a power of two from 64 to 1024.
+/// With subgroups it is capped at 256, as the subgroup radix scatter keeps 256 digit counts per
+/// subgroup in shared memory and larger groups would exceed the guaranteed 32KB.
+/// Counts are limited to workgroupSize * 65535 elements (16M for 256).
+/// sort() scans 256 counts per workgroup, so needs workgroupSize of 256 or more for that many keys.
+class Primitives {
+public:
+  Primitives() {
+  }
+
+  /// Load the kernels from shaderDir. Use subgroups = subgroupsSupported(physicalDevice)
+  /// to select the GL_KHR_shader_subgroup variants. See workgroupSize() for the size used.
+  Primitives(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, const std::string &shaderDir, bool subgroups = false, uint32_t workgroupSize = 256, int framesInFlight = 2) {
+    if (subgroups) workgroupSize = std::min(workgroupSize, (uint32_t)maxSubgroupWorkgroupSize);
+    s.device = device;
+    s.memprops = memprops;
+    s.workgroupSize = workgroupSize;
+
+    std::string variant = subgroups ? ".subgroup.comp.spv" : ".comp.spv";
+    auto kernel = [&](const std::string &name, uint32_t pushConstantSize) {
+      ShaderModule shader{device, shaderDir + name};
+      return ComputeKernel(device, memprops, queueFamilyIndex, std::move(shader), pushConstantSize, {workgroupSize}, framesInFlight);
+    };
+
+    s.scan = kernel("scan" + variant, 8);
+    s.scanAdd = kernel("scan_add.comp.spv", 4);
+    s.reduce = kernel("reduce" + variant, 4);
+    s.compact = kernel("compact.comp.spv", 4);
+    s.histogram = kernel("radix_histogram.comp.spv", 12);
+    s.scatter = kernel("radix_scatter" + variant, 12);
+
+    // Each frame in flight has its own scratch buffers, so one frame's scans and sorts
+    // do not overwrite those of a frame the GPU may still be running.
+    // One block totals buffer per level of the scan. 64^4 covers the largest dispatch.
+    s.frames.resize(std::max(framesInFlight, 1));
+    for (auto &f : s.frames) f.sums.resize(4);
+    s.ok = true;
+  }
+
+  /// Returns true if the device has the subgroup arithmetic and ballot operations in compute shaders.
+  /// Needs Vulkan 1.1.
+  static bool subgroupsSupported(vk::PhysicalDevice physicalDevice) {
+    if (physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_1) return false;
+    auto props = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+    auto &sp = props.get<vk::PhysicalDeviceSubgroupProperties>();
+    typedef vk::SubgroupFeatureFlagBits sf;
+    vk::SubgroupFeatureFlags needed = sf::eBasic|sf::eArithmetic|sf::eBallot;
+    return (sp.supportedOperations & needed) == needed && (sp.supportedStages & vk::ShaderStageFlagBits::eCompute);
+  }
+
+  /// Release the descriptor sets and replaced scratch buffers used by a frame's commands,
+  /// and record the following calls with that frame's scratch buffers.
+  /// Call this when the GPU has finished with the last commands recorded for frameIndex.
+  void beginFrame(int frameIndex) {
+    for (auto k : {&s.scan, &s.scanAdd, &s.reduce, &s.compact, &s.histogram, &s.scatter}) {
+      k->beginFrame(frameIndex);
+    }
+    s.frameIndex = frameIndex % (int)s.frames.size();
+    s.frames[s.frameIndex].retired.clear();
+  }
+
+  /// output[i] = input[0] + ... + input[i-1]. input and output may be the same buffer.
+  void exclusiveScan(vk::CommandBuffer cb, const GenericBuffer &input, const GenericBuffer &output, uint32_t count) {
+    scanLevel(cb, input, output, count, false, 0);
+  }
+
+  /// output[i] = input[0] + ... + input[i]. input and output may be the same buffer.
+  void inclusiveScan(vk::CommandBuffer cb, const GenericBuffer &input, const GenericBuffer &output, uint32_t count) {
+    scanLevel(cb, input, output, count, true, 0);
+  }
+
+  /// Write the sum of count values of input to the first uint32_t of result.
+  void reduce(vk::CommandBuffer cb, const GenericBuffer &input, const GenericBuffer &result, uint32_t count) {
+    typedef vk::PipelineStageFlagBits psflags;
+    typedef vk::AccessFlagBits aflags;
+    cb.fillBuffer(result.buffer(), 0, sizeof(uint32_t), 0);
+    result.barrier(cb, psflags::eTransfer, psflags::eComputeShader, {}, aflags::eTransferWrite, aflags::eShaderRead|aflags::eShaderWrite, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+
+    // Enough workgroups to fill the device, each looping over a slice.
+    uint32_t groups = std::min(numBlocks(count), (uint32_t)1024);
+    s.reduce.pushConstants(count);
+    s.reduce.dispatch(cb, std::max(groups, (uint32_t)1), 1, 1, input, result);
+    computeBarrier(cb);
+  }
+
+  /// Copy the values of input whose flag is 1 to the start of output, in order.
+  /// flags must be 0 or 1. The number of values kept is written to the first uint32_t of outputCount.
+  void compact(vk::CommandBuffer cb, const GenericBuffer &input, const GenericBuffer &flags, const GenericBuffer &output, const GenericBuffer &outputCount, uint32_t count) {
+    if (count == 0) {
+      // Nothing kept, but callers still read the count.
+      typedef vk::PipelineStageFlagBits psflags;
+      typedef vk::AccessFlagBits aflags;
+      cb.fillBuffer(outputCount.buffer(), 0, sizeof(uint32_t), 0);
+      outputCount.barrier(cb, psflags::eTransfer, psflags::eComputeShader|psflags::eTransfer, {}, aflags::eTransferWrite, aflags::eShaderRead|aflags::eShaderWrite|aflags::eTransferRead, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+      return;
+    }
+    GenericBuffer &offsets = scratch(frame().offsets, count);
+    exclusiveScan(cb, flags, offsets, count);
+
+    s.compact.pushConstants(count);
+    s.compact.dispatch(cb, numBlocks(count), 1, 1, input, flags, offsets, output, outputCount);
+    computeBarrier(cb);
+  }
+
+  /// Stable sort of count keys, moving values with them. The result is left in keys and values.
+  void sort(vk::CommandBuffer cb, const GenericBuffer &keys, const GenericBuffer &values, uint32_t count) {
+    if (count == 0) return;
+    uint32_t blocks = numBlocks(count);
+    GenericBuffer &keys2 = scratch(frame().keys, count);
+    GenericBuffer &values2 = scratch(frame().values, count);
+    GenericBuffer &histogram = scratch(frame().histogram256, 256 * blocks);
+
+    // Four passes of eight bits, ping-ponging between the inputs and the scratch buffers.
+    const GenericBuffer *src[] = {&keys, &values};
+    const GenericBuffer *dst[] = {&keys2, &values2};
+    for (uint32_t shift = 0; shift != 32; shift += 8) {
+      struct { uint32_t count, shift, numBlocks; } pc = {count, shift, blocks};
+
+      s.histogram.pushConstants(pc);
+      s.histogram.dispatch(cb, blocks, 1, 1, *src[0], histogram);
+      computeBarrier(cb);
+
+      exclusiveScan(cb, histogram, histogram, 256 * blocks);
+
+      s.scatter.pushConstants(pc);
+      s.scatter.dispatch(cb, blocks, 1, 1, *src[0], *src[1], *dst[0], *dst[1], histogram);
+      computeBarrier(cb);
+
+      std::swap(src[0], dst[0]);
+      std::swap(src[1], dst[1]);
+    }
+  }
+
+  /// Return true if the kernels were loaded.
+  bool ok() const { return s.ok; }
+
+  /// Return the workgroup size used by the kernels.
+  uint32_t workgroupSize() const { return s.workgroupSize; }
+
+private:
+  // radix_scatter.subgroup.comp needs WG / 16 * 256 * 4 bytes of shared memory.
+  enum { maxSubgroupWorkgroupSize = 256 };
+
+  // Scan one level, then scan the block totals and add them back if there is more than one block.
+  void scanLevel(vk::CommandBuffer cb, const GenericBuffer &input, const GenericBuffer &output, uint32_t count, bool inclusive, size_t level) {
+    if (count == 0) return;
+    uint32_t blocks = numBlocks(count);
+    GenericBuffer &sums = scratch(frame().sums[level], blocks);
+
+    struct { uint32_t count, inclusive; } pc = {count, inclusive ? 1u : 0u};
+    s.scan.pushConstants(pc);
+    s.scan.dispatch(cb, blocks, 1, 1, input, output, sums);
+    computeBarrier(cb);
+
+    if (blocks > 1) {
+      scanLevel(cb, sums, sums, blocks, false, level + 1);
+      s.scanAdd.pushConstants(count);
+      s.scanAdd.dispatch(cb, blocks, 1, 1, output, sums);
+      computeBarrier(cb);
+    }
+  }
+
+  // Make sure a scratch buffer of the current frame holds count values.
+  // Buffers that are replaced may still be in use by this frame's commands,
+  // so they live until beginFrame() comes back to this frame.
+  GenericBuffer &scratch(GenericBuffer &buffer, uint32_t count) {
+    vk::DeviceSize size = std::max(count, (uint32_t)1) * sizeof(uint32_t);
+    if (!buffer.buffer() || buffer.size() < size) {
+      typedef vk::BufferUsageFlagBits buf;
+      if (buffer.buffer()) frame().retired.push_back(std::move(buffer));
+      buffer = GenericBuffer(s.device, s.memprops, buf::eStorageBuffer|buf::eTransferSrc|buf::eTransferDst, size);
+    }
+    return buffer;
+  }
+
+  struct FrameScratch {
+    std::vector<GenericBuffer> sums;
+    GenericBuffer offsets;
+    GenericBuffer keys;
+    GenericBuffer values;
+    GenericBuffer histogram256;
+    std::vector<GenericBuffer> retired;
+  };
+
+  FrameScratch &frame() { return s.frames[s.frameIndex]; }
+
+  uint32_t numBlocks(uint32_t count) const {
+    return (count + s.workgroupSize - 1) / s.workgroupSize;
+  }
+
+  // Make compute shader writes visible to following compute shaders and transfers.
+  static void computeBarrier(vk::CommandBuffer cb) {
+    typedef vk::PipelineStageFlagBits psflags;
+    typedef vk::AccessFlagBits aflags;
+    vk::MemoryBarrier mb{aflags::eShaderWrite, aflags::eShaderRead|aflags::eShaderWrite|aflags::eTransferRead};
+    cb.pipelineBarrier(psflags::eComputeShader, psflags::eComputeShader|psflags::eTransfer, {}, mb, nullptr, nullptr);
+    VKU_COUNT(barriers, 1);
+  }
+
+  struct State {
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memprops;
+    uint32_t workgroupSize = 256;
+    ComputeKernel scan;
+    ComputeKernel scanAdd;
+    ComputeKernel reduce;
+    ComputeKernel compact;
+    ComputeKernel histogram;
+    ComputeKernel scatter;
+    std::vector<FrameScratch> frames;
+    int frameIndex = 0;
+    bool ok = false;
+  };
+
+  State s;
+};
+
+} // namespace vku
+
+#endif // VKU_PRIMITIVES_HPP
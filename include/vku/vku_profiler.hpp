@@ -0,0 +1,507 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU profiling for the Vookoo high level C++ Vulkan interface.
+//
+// Timestamp queries around named zones in command buffers, and pipeline
+// statistics and occlusion queries around named scopes, read back a few
+// frames later without stalling. Timings export as Chrome trace JSON
+// (chrome://tracing or https://ui.perfetto.dev) or CSV.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VKU_PROFILER_HPP
+#define VKU_PROFILER_HPP
+
+#include <vku/vku.hpp>
+
+#include <deque>
+#include <ostream>
+#include <string>
+
+namespace vku {
+
+/// The time spent in one zone of a frame.
+struct GpuZoneTiming {
+  std::string name;
+
+  /// Nesting level, 0 for outermost zones.
+  int depth;
+
+  /// Start time relative to the first timestamp the profiler saw, and duration, in milliseconds.
+  double startMs;
+  double durationMs;
+};
+
+/// What the GPU did during a scope. Pipeline statistics are zero unless enabled.
+struct GpuPipelineStats {
+  uint64_t inputPrimitives = 0;
+  uint64_t vertexInvocations = 0;
+  uint64_t clippingInvocations = 0;
+  uint64_t clippingPrimitives = 0;
+  uint64_t fragmentInvocations = 0;
+  uint64_t computeInvocations = 0;
+
+  /// Samples that passed the depth and stencil tests, from an occlusion query.
+  uint64_t samplesPassed = 0;
+
+  GpuPipelineStats &operator+=(const GpuPipelineStats &rhs) {
+    inputPrimitives += rhs.inputPrimitives;
+    vertexInvocations += rhs.vertexInvocations;
+    clippingInvocations += rhs.clippingInvocations;
+    clippingPrimitives += rhs.clippingPrimitives;
+    fragmentInvocations += rhs.fragmentInvocations;
+    computeInvocations += rhs.computeInvocations;
+    samplesPassed += rhs.samplesPassed;
+    return *this;
+  }
+};
+
+/// The statistics of one query scope of a frame.
+struct GpuScopeStats {
+  std::string name;
+  GpuPipelineStats stats;
+};
+
+/// Everything measured on the GPU for one frame.
+struct GpuFrameStats {
+  uint64_t frame = 0;
+
+  /// From the start of the first zone to the end of the last.
+  double gpuMs = 0;
+
+  std::vector<GpuZoneTiming> zones;
+
+  std::vector<GpuScopeStats> scopes;
+
+  /// The sum of all the scopes.
+  GpuPipelineStats totals;
+};
+
+/// Time named zones of command buffers with timestamp queries.
+/// There is a query pool for each frame in flight; the results of a frame are read
+/// when its slot comes round again, so reading never waits for the GPU.
+/// example:
+///     vku::GpuProfiler profiler{device, physicalDevice, queueFamilyIndex, framesInFlight};
+///
+///     // Each frame, after waiting for the frame's fence:
+///     cb.begin(...);
+///     profiler.beginFrame(cb, frameIndex);
+///     {
+///       vku::GpuZone zone{profiler, cb, "shadows"};
+///       ...
+///     }
+///     profiler.begin(cb, "main pass");
+///     cb.beginRenderPass(...); ... cb.endRenderPass();
+///     profiler.end(cb);
+///     cb.end();
+///
+///     // At exit:
+///     profiler.saveChromeTrace("trace.json");
+///
+/// If the queue family has no timestampValidBits the zones are not timed.
+///
+/// After enableQueries(), beginQuery()/endQuery() or a GpuQueryScope count samples passed
+/// and, with the pipelineStatisticsQuery feature, shader invocations and primitives:
+///     profiler.enableQueries(64, fw.pipelineStatisticsQuery());
+///     ...
+///     cb.beginRenderPass(...);
+///     {
+///       vku::GpuQueryScope scope{profiler, cb, "opaque"};
+///       ...
+///     }
+///     auto &stats = profiler.lastFrame().totals;
+///
+/// Query scopes do not nest and one begun in a render pass must end in the same subpass.
+class GpuProfiler {
+public:
+  GpuProfiler() {
+  }
+
+  /// Make query pools for framesInFlight frames of up to maxZones zones each.
+  /// maxHistory frames of results are kept for export.
+  GpuProfiler(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t queueFamilyIndex, int framesInFlight = 2, uint32_t maxZones = 256, size_t maxHistory = 1000) {
+    s.device = device;
+    s.maxZones = maxZones;
+    s.maxHistory = maxHistory;
+    s.period = physicalDevice.getProperties().limits.timestampPeriod;
+
+    s.frames.resize(framesInFlight);
+
+    auto qprops = physicalDevice.getQueueFamilyProperties();
+    uint32_t validBits = queueFamilyIndex < qprops.size() ? qprops[queueFamilyIndex].timestampValidBits : 0;
+    if (validBits == 0) return;
+    s.mask = validBits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << validBits) - 1;
+
+    vk::QueryPoolCreateInfo qpci{{}, vk::QueryType::eTimestamp, maxZones * 2};
+    for (auto &f : s.frames) {
+      f.pool = device.createQueryPoolUnique(qpci);
+    }
+    s.ok = true;
+  }
+
+  /// Make occlusion query pools for up to maxScopes scopes per frame, and pipeline statistics
+  /// pools too if the device's pipelineStatisticsQuery feature is enabled.
+  void enableQueries(uint32_t maxScopes, bool pipelineStatistics) {
+    s.maxScopes = maxScopes;
+    vk::QueryPoolCreateInfo occlusion{{}, vk::QueryType::eOcclusion, maxScopes};
+    vk::QueryPoolCreateInfo statistics{{}, vk::QueryType::ePipelineStatistics, maxScopes, statisticFlags()};
+    for (auto &f : s.frames) {
+      f.occlusionPool = s.device.createQueryPoolUnique(occlusion);
+      if (pipelineStatistics) f.statisticsPool = s.device.createQueryPoolUnique(statistics);
+      f.scopes.clear();
+    }
+  }
+
+  /// Collect the results of the last use of this frame slot and reset its queries.
+  /// Call outside a render pass, at the start of the frame's first command buffer
+  /// after waiting for the frame's fence.
+  void beginFrame(vk::CommandBuffer cb, int frameIndex) {
+    if (s.frames.empty()) return;
+    s.frameIndex = frameIndex;
+    Frame &f = s.frames[frameIndex];
+    collect(f);
+
+    if (f.pool) cb.resetQueryPool(*f.pool, 0, s.maxZones * 2);
+    if (f.occlusionPool) cb.resetQueryPool(*f.occlusionPool, 0, s.maxScopes);
+    if (f.statisticsPool) cb.resetQueryPool(*f.statisticsPool, 0, s.maxScopes);
+    f.zones.clear();
+    f.scopes.clear();
+    f.frame = s.frameNumber++;
+    f.pending = true;
+    s.stack.clear();
+    s.activeScope = ~0u;
+  }
+
+  /// Start a zone. Zones nest and may span render passes and command buffers of the same frame.
+  void begin(vk::CommandBuffer cb, const std::string &name, vk::PipelineStageFlagBits stage = vk::PipelineStageFlagBits::eTopOfPipe) {
+    if (!s.ok) return;
+    Frame &f = s.frames[s.frameIndex];
+    if (f.zones.size() == s.maxZones) {
+      // Out of queries: count the zone so that end() still matches, but do not time it.
+      s.stack.push_back(~0u);
+      return;
+    }
+    uint32_t zone = (uint32_t)f.zones.size();
+    f.zones.push_back(Zone{name, (int)s.stack.size()});
+    s.stack.push_back(zone);
+    cb.writeTimestamp(stage, *f.pool, zone * 2);
+  }
+
+  /// End the innermost zone.
+  void end(vk::CommandBuffer cb, vk::PipelineStageFlagBits stage = vk::PipelineStageFlagBits::eBottomOfPipe) {
+    if (!s.ok || s.stack.empty()) return;
+    uint32_t zone = s.stack.back();
+    s.stack.pop_back();
+    if (zone == ~0u) return;
+    cb.writeTimestamp(stage, *s.frames[s.frameIndex].pool, zone * 2 + 1);
+  }
+
+  /// Start counting for a query scope. precise needs the occlusionQueryPrecise feature
+  /// and makes samplesPassed exact rather than just non-zero when anything is visible.
+  void beginQuery(vk::CommandBuffer cb, const std::string &name, bool precise = false) {
+    if (s.frames.empty() || s.activeScope != ~0u) return;
+    Frame &f = s.frames[s.frameIndex];
+    if (!f.occlusionPool || f.scopes.size() == s.maxScopes) return;
+    s.activeScope = (uint32_t)f.scopes.size();
+    f.scopes.push_back(name);
+    cb.beginQuery(*f.occlusionPool, s.activeScope, precise ? vk::QueryControlFlagBits::ePrecise : vk::QueryControlFlags{});
+    if (f.statisticsPool) cb.beginQuery(*f.statisticsPool, s.activeScope, vk::QueryControlFlags{});
+  }
+
+  /// End the current query scope.
+  void endQuery(vk::CommandBuffer cb) {
+    if (s.activeScope == ~0u) return;
+    Frame &f = s.frames[s.frameIndex];
+    cb.endQuery(*f.occlusionPool, s.activeScope);
+    if (f.statisticsPool) cb.endQuery(*f.statisticsPool, s.activeScope);
+    s.activeScope = ~0u;
+  }
+
+  /// Return the most recent frame with results, or an empty frame if there is none yet.
+  const GpuFrameStats &lastFrame() const {
+    static const GpuFrameStats empty;
+    return s.history.empty() ? empty : s.history.back();
+  }
+
+  /// Return up to maxHistory frames of results, oldest first.
+  const std::deque<GpuFrameStats> &history() const { return s.history; }
+
+  /// Return the number of frames whose results were not ready when their slot came round.
+  uint64_t droppedFrames() const { return s.droppedFrames; }
+
+  /// Return true if the queue family supports timestamps.
+  bool ok() const { return s.ok; }
+
+  /// Write the history as Chrome trace events. Nesting is shown by the viewer from the times.
+  void writeChromeTrace(std::ostream &os) const {
+    StreamFormat format(os, 3);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char *sep = "\n";
+    for (auto &frame : s.history) {
+      for (auto &z : frame.zones) {
+        os << sep << "{\"name\":\"" << jsonEscape(z.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0";
+        os << ",\"ts\":" << z.startMs * 1000 << ",\"dur\":" << z.durationMs * 1000;
+        os << ",\"args\":{\"frame\":" << frame.frame << "}}";
+        sep = ",\n";
+      }
+    }
+    os << "\n]}\n";
+  }
+
+  /// Write the history as CSV with a header line.
+  void writeCsv(std::ostream &os) const {
+    StreamFormat format(os, 6);
+    os << "frame,zone,depth,start_ms,duration_ms\n";
+    for (auto &frame : s.history) {
+      for (auto &z : frame.zones) {
+        os << frame.frame << "," << csvEscape(z.name) << "," << z.depth << "," << z.startMs << "," << z.durationMs << "\n";
+      }
+    }
+  }
+
+  /// Write the query scopes of the history as CSV with a header line.
+  void writeStatsCsv(std::ostream &os) const {
+    os << "frame,scope,input_primitives,vertex_invocations,clipping_invocations,clipping_primitives,fragment_invocations,compute_invocations,samples_passed\n";
+    for (auto &frame : s.history) {
+      for (auto &scope : frame.scopes) {
+        auto &st = scope.stats;
+        os << frame.frame << "," << csvEscape(scope.name) << "," << st.inputPrimitives << "," << st.vertexInvocations << ",";
+        os << st.clippingInvocations << "," << st.clippingPrimitives << "," << st.fragmentInvocations << ",";
+        os << st.computeInvocations << "," << st.samplesPassed << "\n";
+      }
+    }
+  }
+
+  /// Write a Chrome trace file. Returns false if the file could not be written.
+  bool saveChromeTrace(const std::string &filename) const {
+    std::ofstream file(filename);
+    writeChromeTrace(file);
+    return (bool)file;
+  }
+
+  /// Write a CSV file. Returns false if the file could not be written.
+  bool saveCsv(const std::string &filename) const {
+    std::ofstream file(filename);
+    writeCsv(file);
+    return (bool)file;
+  }
+
+private:
+  struct Zone {
+    std::string name;
+    int depth;
+  };
+
+  struct Frame {
+    vk::UniqueQueryPool pool;
+    vk::UniqueQueryPool occlusionPool;
+    vk::UniqueQueryPool statisticsPool;
+    std::vector<Zone> zones;
+    std::vector<std::string> scopes;
+    uint64_t frame = 0;
+    bool pending = false;
+  };
+
+  // The statistics counted, in the order the results are written.
+  static vk::QueryPipelineStatisticFlags statisticFlags() {
+    typedef vk::QueryPipelineStatisticFlagBits qps;
+    return qps::eInputAssemblyPrimitives|qps::eVertexShaderInvocations|qps::eClippingInvocations|
+      qps::eClippingPrimitives|qps::eFragmentShaderInvocations|qps::eComputeShaderInvocations;
+  }
+
+  // Read a frame's queries if the GPU has written them all.
+  void collect(Frame &f) {
+    if (!f.pending) return;
+    f.pending = false;
+    if (f.zones.empty() && f.scopes.empty()) return;
+
+    GpuFrameStats stats;
+    stats.frame = f.frame;
+    if ((!f.zones.empty() && !collectZones(f, stats)) || (!f.scopes.empty() && !collectScopes(f, stats))) {
+      ++s.droppedFrames;
+      return;
+    }
+
+    s.history.push_back(std::move(stats));
+    while (s.history.size() > s.maxHistory) s.history.pop_front();
+  }
+
+  bool collectZones(Frame &f, GpuFrameStats &stats) {
+    uint32_t count = (uint32_t)f.zones.size() * 2;
+    s.timestamps.resize(count);
+    auto result = s.device.getQueryPoolResults(*f.pool, 0, count, count * sizeof(uint64_t), s.timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess) return false;
+
+    // Only the low timestampValidBits count, so take differences modulo the mask.
+    if (!s.hasOrigin) {
+      s.origin = s.timestamps[0] & s.mask;
+      s.hasOrigin = true;
+    }
+    auto ms = [this](uint64_t ticks) { return (double)ticks * s.period * 1e-6; };
+
+    double first = 0, last = 0;
+    for (size_t i = 0; i != f.zones.size(); ++i) {
+      uint64_t begin = s.timestamps[i * 2] & s.mask;
+      uint64_t end = s.timestamps[i * 2 + 1] & s.mask;
+      GpuZoneTiming z;
+      z.name = f.zones[i].name;
+      z.depth = f.zones[i].depth;
+      z.startMs = ms((begin - s.origin) & s.mask);
+      z.durationMs = ms((end - begin) & s.mask);
+      first = i ? std::min(first, z.startMs) : z.startMs;
+      last = i ? std::max(last, z.startMs + z.durationMs) : z.startMs + z.durationMs;
+      stats.zones.push_back(std::move(z));
+    }
+    stats.gpuMs = last - first;
+    return true;
+  }
+
+  bool collectScopes(Frame &f, GpuFrameStats &stats) {
+    uint32_t count = (uint32_t)f.scopes.size();
+    const uint32_t numStatistics = 6;
+    s.samples.resize(count);
+    s.statistics.resize(count * numStatistics);
+    auto flags = vk::QueryResultFlagBits::e64;
+    if (s.device.getQueryPoolResults(*f.occlusionPool, 0, count, count * sizeof(uint64_t), s.samples.data(), sizeof(uint64_t), flags) != vk::Result::eSuccess) {
+      return false;
+    }
+    if (f.statisticsPool) {
+      vk::DeviceSize stride = numStatistics * sizeof(uint64_t);
+      if (s.device.getQueryPoolResults(*f.statisticsPool, 0, count, count * stride, s.statistics.data(), stride, flags) != vk::Result::eSuccess) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i != count; ++i) {
+      GpuScopeStats scope;
+      scope.name = f.scopes[i];
+      scope.stats.samplesPassed = s.samples[i];
+      if (f.statisticsPool) {
+        const uint64_t *st = s.statistics.data() + i * numStatistics;
+        scope.stats.inputPrimitives = st[0];
+        scope.stats.vertexInvocations = st[1];
+        scope.stats.clippingInvocations = st[2];
+        scope.stats.clippingPrimitives = st[3];
+        scope.stats.fragmentInvocations = st[4];
+        scope.stats.computeInvocations = st[5];
+      }
+      stats.totals += scope.stats;
+      stats.scopes.push_back(std::move(scope));
+    }
+    return true;
+  }
+
+  // Fixed point output, restoring the stream's format afterwards.
+  class StreamFormat {
+  public:
+    StreamFormat(std::ostream &os, int precision) : os_(os), flags_(os.flags()), precision_(os.precision()) {
+      os_.setf(std::ios::fixed, std::ios::floatfield);
+      os_.precision(precision);
+    }
+    ~StreamFormat() {
+      os_.flags(flags_);
+      os_.precision(precision_);
+    }
+  private:
+    std::ostream &os_;
+    std::ios::fmtflags flags_;
+    std::streamsize precision_;
+  };
+
+  static std::string jsonEscape(const std::string &str) {
+    std::string result;
+    for (char c : str) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+        result += c;
+      } else if ((unsigned char)c < 0x20) {
+        result += ' ';
+      } else {
+        result += c;
+      }
+    }
+    return std::move(result);
+  }
+
+  static std::string csvEscape(const std::string &str) {
+    if (str.find_first_of(",\"\n") == std::string::npos) return str;
+    std::string result = "\"";
+    for (char c : str) {
+      if (c == '"') result += '"';
+      result += c;
+    }
+    result += '"';
+    return std::move(result);
+  }
+
+  struct State {
+    vk::Device device;
+    std::vector<Frame> frames;
+    std::vector<uint32_t> stack;
+    std::vector<uint64_t> timestamps;
+    std::vector<uint64_t> samples;
+    std::vector<uint64_t> statistics;
+    std::deque<GpuFrameStats> history;
+    uint32_t maxZones = 0;
+    uint32_t maxScopes = 0;
+    uint32_t activeScope = ~0u;
+    size_t maxHistory = 0;
+    float period = 1;
+    uint64_t mask = ~(uint64_t)0;
+    uint64_t origin = 0;
+    uint64_t frameNumber = 0;
+    uint64_t droppedFrames = 0;
+    int frameIndex = 0;
+    bool hasOrigin = false;
+    bool ok = false;
+  };
+
+  State s;
+};
+
+/// Time a zone from construction to the end of the scope.
+/// example:
+///     {
+///       vku::GpuZone zone{profiler, cb, "bloom"};
+///       ...
+///     }
+class GpuZone {
+public:
+  GpuZone(GpuProfiler &profiler, vk::CommandBuffer cb, const std::string &name) : profiler_(profiler), cb_(cb) {
+    profiler_.begin(cb_, name);
+  }
+
+  ~GpuZone() {
+    profiler_.end(cb_);
+  }
+
+  GpuZone(const GpuZone &) = delete;
+  GpuZone &operator=(const GpuZone &) = delete;
+
+private:
+  GpuProfiler &profiler_;
+  vk::CommandBuffer cb_;
+};
+
+/// Count samples and pipeline statistics from construction to the end of the scope.
+class GpuQueryScope {
+public:
+  GpuQueryScope(GpuProfiler &profiler, vk::CommandBuffer cb, const std::string &name, bool precise = false) : profiler_(profiler), cb_(cb) {
+    profiler_.beginQuery(cb_, name, precise);
+  }
+
+  ~GpuQueryScope() {
+    profiler_.endQuery(cb_);
+  }
+
+  GpuQueryScope(const GpuQueryScope &) = delete;
+  GpuQueryScope &operator=(const GpuQueryScope &) = delete;
+
+private:
+  GpuProfiler &profiler_;
+  vk::CommandBuffer cb_;
+};
+
+} // namespace vku
+
+#endif // VKU_PROFILER_HPP